@@ -0,0 +1,340 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+	Frame taken by CAMERA, one bit per pixel with 1 for black.
+	Rows are packed like a binary PBM ( first pixel in the top bit, every row padded
+	to a whole byte ) so writers can hand the rows on as they are
+*/
+struct Frame {
+	std::size_t width{ 0 };
+	std::size_t height{ 0 };
+	std::size_t stride{ 0 }; //Bytes in a row
+	std::vector<std::uint8_t> bits;
+
+	Frame() = default;
+	Frame(std::size_t w, std::size_t h) {
+		reset(w, h);
+	}
+
+	//Reshape keeping the storage already allocated, the pixels are left as they were
+	void reset(std::size_t w, std::size_t h) {
+		width = w;
+		height = h;
+		stride = (w + 7) / 8;
+		bits.resize(stride * h);
+	}
+
+	std::uint8_t* row(std::size_t r) { return bits.data() + r * stride; }
+	std::uint8_t const* row(std::size_t r) const { return bits.data() + r * stride; }
+
+	bool get(std::size_t r, std::size_t c) const {
+		return (row(r)[c >> 3] >> (7 - (c & 7))) & 1;
+	}
+
+	void set(std::size_t r, std::size_t c, bool value) {
+		std::uint8_t mask = (std::uint8_t)(0x80 >> (c & 7));
+		if (value) row(r)[c >> 3] |= mask;
+		else row(r)[c >> 3] &= (std::uint8_t)~mask;
+	}
+};
+
+/*
+	Where the frames of CAMERA go. A frame is only valid during write(),
+	the interpreter reuses it for the next one
+*/
+class FrameSink {
+public:
+	virtual ~FrameSink() = default;
+	virtual void write(Frame const& frame) = 0;
+};
+
+//Keeps every frame in memory
+class FrameStore : public FrameSink {
+public:
+	std::vector<Frame> frames;
+
+	void write(Frame const& frame) override {
+		frames.push_back(frame);
+	}
+};
+
+//Keeps only the first frame, for when only that one is wanted
+class FirstFrame : public FrameSink {
+public:
+	Frame frame;
+	bool taken{ false };
+
+	void write(Frame const& f) override {
+		if (taken) return;
+		frame = f;
+		taken = true;
+	}
+};
+
+//Binary PBM ( P4 ) of a frame into buffer, the header followed by the rows as they are
+inline void encodePBM(Frame const& frame, std::vector<char>& buffer) {
+	std::string header = "P4\n" + std::to_string(frame.width) + ' ' + std::to_string(frame.height) + '\n';
+	buffer.resize(header.size() + frame.bits.size());
+	std::copy(header.begin(), header.end(), buffer.begin());
+	std::copy(frame.bits.begin(), frame.bits.end(), buffer.begin() + header.size());
+}
+
+//Name of the n-th file of a sequence, stem_0000.pbm, stem_0001.pbm, ...
+inline std::string sequenceName(std::string const& stem, std::size_t n) {
+	std::string number = std::to_string(n);
+	if (number.size() < 4) number.insert(0, 4 - number.size(), '0');
+	return stem + '_' + number + ".pbm";
+}
+
+/*
+	Where encoded frames end up, emit( number, bytes ) is called once for every frame.
+	Ordered outputs get the frames one at a time in the order they were taken,
+	the others may be called from several writers at once
+*/
+struct FrameOutput {
+	std::function<void(std::size_t, std::vector<char> const&)> emit;
+	bool ordered{ true };
+};
+
+//Every frame into its own numbered file, files do not depend on each other so any order will do
+inline FrameOutput sequenceFiles(std::string stem) {
+	return { [stem = std::move(stem)](std::size_t n, std::vector<char> const& encoded) {
+		std::ofstream out(sequenceName(stem, n), std::ofstream::out | std::ofstream::binary);
+		out.write(encoded.data(), encoded.size());
+		if (!out) {
+			throw std::exception{ "Could not write a frame" };
+		}
+	}, false };
+}
+
+//Every frame one after another into a single stream, netpbm tools read it as a sequence of images
+inline FrameOutput streamTo(std::ostream& out) {
+	return { [&out](std::size_t, std::vector<char> const& encoded) {
+		out.write(encoded.data(), encoded.size());
+		if (!out) {
+			throw std::exception{ "Could not write a frame" };
+		}
+	}, true };
+}
+
+//Time spent on every side of the writer, in seconds
+struct FrameTimings {
+	struct Stage {
+		double total{ 0 };
+		double longest{ 0 };
+
+		void add(double seconds) {
+			total += seconds;
+			longest = std::max(longest, seconds);
+		}
+	};
+
+	std::size_t frames{ 0 };	//Written
+	std::size_t enqueued{ 0 };	//Taken from the interpreter, render and wait are per these
+	Stage render;	//Interpreter between two frames, packing included
+	Stage wait;		//Interpreter waiting for a free buffer
+	Stage encode;
+	Stage write;
+};
+
+/*
+	Encodes and writes frames as PBM on background threads so CAMERA only pays for a copy.
+	Frames are copied into a fixed pool of buffers, once every buffer is taken write() blocks
+	until a writer hands one back. Buffers keep their storage, after the first few frames
+	nothing is allocated anymore. Errors of the writers come out of every later write(),
+	or out of finish() when no write() has thrown them yet
+*/
+class PBMWriter : public FrameSink {
+public:
+	static constexpr std::size_t maxWriters = 64;
+
+	explicit PBMWriter(FrameOutput output, std::size_t writers = 1, std::size_t depth = 4)
+		:output(std::move(output)), slots(std::max<std::size_t>(depth, 1)), queue(slots.size()) {
+		for (std::size_t s = 0; s < slots.size(); s++) free.push_back(s);
+		last = Clock::now();
+		for (std::size_t w = 0; w < std::min(std::max<std::size_t>(writers, 1), maxWriters); w++) {
+			threads.emplace_back([this] { work(); });
+		}
+	}
+
+	PBMWriter(PBMWriter const&) = delete;
+	PBMWriter& operator=(PBMWriter const&) = delete;
+
+	~PBMWriter() {
+		try {
+			finish();
+		}
+		catch (...) {}
+	}
+
+	void write(Frame const& frame) override {
+		auto start = Clock::now();
+		std::size_t s;
+		{
+			std::unique_lock<std::mutex> lock(state);
+			rethrow();
+			roomy.wait(lock, [this] { return !free.empty() || error; });
+			rethrow();
+			//Without an error the wait only ends with a buffer in free
+			s = free.back();
+			free.pop_back();
+		}
+		auto taken = Clock::now();
+
+		//Copy assignment keeps the storage of the buffer
+		slots[s].frame = frame;
+		{
+			std::lock_guard<std::mutex> guard(state);
+			slots[s].number = queued++;
+			queue[(head + pending++) % queue.size()] = s;
+			stats.enqueued++;
+			stats.render.add(seconds(start - last));
+			stats.wait.add(seconds(taken - start));
+		}
+		ready.notify_one();
+		last = Clock::now();
+	}
+
+	//Waits for every frame taken so far to be written, stops the writers
+	void finish() {
+		{
+			std::lock_guard<std::mutex> guard(state);
+			closing = true;
+		}
+		ready.notify_all();
+		for (std::thread& t : threads) t.join();
+		threads.clear();
+		std::lock_guard<std::mutex> guard(state);
+		if (!reported) rethrow();
+	}
+
+	std::size_t frames() const {
+		std::lock_guard<std::mutex> guard(state);
+		return written;
+	}
+
+	FrameTimings timings() const {
+		std::lock_guard<std::mutex> guard(state);
+		return stats;
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Slot {
+		Frame frame;
+		std::vector<char> encoded;
+		std::size_t number{ 0 };
+	};
+
+	static double seconds(Clock::duration d) {
+		return std::chrono::duration<double>(d).count();
+	}
+
+	//Hands an error of a writer to the interpreter, needs the lock
+	void rethrow() {
+		if (error) {
+			reported = true;
+			std::rethrow_exception(error);
+		}
+	}
+
+	void work() {
+		for (;;) {
+			std::size_t s;
+			{
+				std::unique_lock<std::mutex> lock(state);
+				ready.wait(lock, [this] { return pending != 0 || closing; });
+				if (pending == 0) return;
+				s = queue[head];
+				head = (head + 1) % queue.size();
+				pending--;
+			}
+
+			Slot& slot = slots[s];
+			double encodeTime = 0, writeTime = 0;
+			bool failed = false;
+			try {
+				auto start = Clock::now();
+				encodePBM(slot.frame, slot.encoded);
+				auto encoded = Clock::now();
+				encodeTime = seconds(encoded - start);
+
+				if (output.ordered) {
+					std::unique_lock<std::mutex> lock(state);
+					turn.wait(lock, [this, &slot] { return next == slot.number; });
+					failed = (bool)error;
+				}
+				else {
+					std::lock_guard<std::mutex> guard(state);
+					failed = (bool)error;
+				}
+
+				//After an error the frames still queued are dropped
+				if (!failed) {
+					auto begin = Clock::now();
+					output.emit(slot.number, slot.encoded);
+					writeTime = seconds(Clock::now() - begin);
+				}
+			}
+			catch (...) {
+				failed = true;
+				std::lock_guard<std::mutex> guard(state);
+				if (!error) error = std::current_exception();
+			}
+
+			{
+				//A frame that failed early still waits for its turn, or the ones before it would be skipped
+				std::unique_lock<std::mutex> lock(state);
+				if (output.ordered) turn.wait(lock, [this, &slot] { return next == slot.number; });
+				if (!failed) {
+					written++;
+					stats.frames++;
+					stats.encode.add(encodeTime);
+					stats.write.add(writeTime);
+				}
+				if (output.ordered) next++;
+				free.push_back(s);
+			}
+			turn.notify_all();
+			roomy.notify_one();
+		}
+	}
+
+	FrameOutput output;
+	std::vector<Slot> slots;
+	std::vector<std::thread> threads;
+
+	mutable std::mutex state;
+	std::condition_variable ready;	//Frames waiting for a writer
+	std::condition_variable roomy;	//Buffers back in the pool
+	std::condition_variable turn;	//Next frame of an ordered output
+	std::vector<std::size_t> free;
+	std::vector<std::size_t> queue;	//Ring of the buffers waiting, at most one entry for every buffer
+	std::size_t head{ 0 };
+	std::size_t pending{ 0 };
+	std::size_t queued{ 0 };
+	std::size_t next{ 0 };
+	std::size_t written{ 0 };
+	bool closing{ false };
+
+	std::exception_ptr error;
+	bool reported{ false };
+
+	FrameTimings stats;
+	Clock::time_point last;
+};
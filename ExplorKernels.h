@@ -0,0 +1,416 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define EXPLOR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//GCC and Clang need the instruction set enabled per function, MSVC accepts the intrinsics anywhere
+#if defined(EXPLOR_X86) && (defined(__GNUC__) || defined(__clang__))
+#define EXPLOR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define EXPLOR_TARGET(isa)
+#endif
+
+/*
+	Whole image kernels working on pixel indices ( 0-35 )
+	Each has a scalar version and vectorized ones, the best one for the
+	running cpu is selected on first use
+*/
+namespace kernels {
+
+	//Translate every pixel through a 36 entry table
+	using MapFunction = void(*)(char* pixels, std::size_t count, char const* table);
+	//Translate only the pixels whose mask byte is set
+	using MaskedMapFunction = void(*)(char* pixels, char const* mask, std::size_t count, char const* table);
+
+	inline void map_scalar(char* pixels, std::size_t count, char const* table) {
+		for (std::size_t i = 0; i < count; i++) {
+			pixels[i] = table[(std::size_t)pixels[i]];
+		}
+	}
+
+	inline void map_masked_scalar(char* pixels, char const* mask, std::size_t count, char const* table) {
+		for (std::size_t i = 0; i < count; i++) {
+			if (mask[i]) pixels[i] = table[(std::size_t)pixels[i]];
+		}
+	}
+
+	/*
+		Pixels through a table of 0s and 1s into bits, 8 to a byte with the first in the top bit ( like PBM ).
+		Gives up and returns false on a pixel the table maps to anything else, out is then only partly written
+	*/
+	using PackFunction = bool(*)(char const* pixels, std::size_t count, char const* table, std::uint8_t* out);
+
+	inline bool pack_scalar(char const* pixels, std::size_t count, char const* table, std::uint8_t* out) {
+		for (std::size_t b = 0; b * 8 < count; b++) {
+			std::size_t bits = std::min<std::size_t>(8, count - b * 8);
+			unsigned int byte = 0;
+			for (std::size_t k = 0; k < bits; k++) {
+				unsigned int value = (unsigned char)table[(std::size_t)pixels[b * 8 + k]];
+				if (value > 1) return false;
+				byte |= value << (7 - k);
+			}
+			out[b] = (std::uint8_t)byte;
+		}
+		return true;
+	}
+
+#ifdef EXPLOR_X86
+
+	/*
+		pshufb only looks up 16 entries so the table is split into 3 parts ( 0-15, 16-31, 32-35 ).
+		Adding 0x70 with saturation pushes indices outside of a part above 0x7F,
+		for which pshufb returns 0, so the three lookups can simply be or'ed together
+	*/
+	EXPLOR_TARGET("ssse3")
+	inline __m128i lookup_ssse3(__m128i v, __m128i t0, __m128i t1, __m128i t2) {
+		const __m128i bias = _mm_set1_epi8(0x70);
+		__m128i r0 = _mm_shuffle_epi8(t0, _mm_adds_epu8(v, bias));
+		__m128i r1 = _mm_shuffle_epi8(t1, _mm_adds_epu8(_mm_sub_epi8(v, _mm_set1_epi8(16)), bias));
+		__m128i r2 = _mm_shuffle_epi8(t2, _mm_adds_epu8(_mm_sub_epi8(v, _mm_set1_epi8(32)), bias));
+		return _mm_or_si128(_mm_or_si128(r0, r1), r2);
+	}
+
+	EXPLOR_TARGET("ssse3")
+	inline void map_ssse3(char* pixels, std::size_t count, char const* table) {
+		char padded[48] = { 0 };
+		for (std::size_t i = 0; i < 36; i++) padded[i] = table[i];
+		const __m128i t0 = _mm_loadu_si128((__m128i const*)padded);
+		const __m128i t1 = _mm_loadu_si128((__m128i const*)(padded + 16));
+		const __m128i t2 = _mm_loadu_si128((__m128i const*)(padded + 32));
+
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m128i v = _mm_loadu_si128((__m128i const*)(pixels + i));
+			_mm_storeu_si128((__m128i*)(pixels + i), lookup_ssse3(v, t0, t1, t2));
+		}
+		map_scalar(pixels + i, count - i, table);
+	}
+
+	EXPLOR_TARGET("sse4.1")
+	inline void map_masked_sse41(char* pixels, char const* mask, std::size_t count, char const* table) {
+		char padded[48] = { 0 };
+		for (std::size_t i = 0; i < 36; i++) padded[i] = table[i];
+		const __m128i t0 = _mm_loadu_si128((__m128i const*)padded);
+		const __m128i t1 = _mm_loadu_si128((__m128i const*)(padded + 16));
+		const __m128i t2 = _mm_loadu_si128((__m128i const*)(padded + 32));
+
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m128i v = _mm_loadu_si128((__m128i const*)(pixels + i));
+			__m128i m = _mm_loadu_si128((__m128i const*)(mask + i));
+			__m128i r = _mm_blendv_epi8(v, lookup_ssse3(v, t0, t1, t2), m);
+			_mm_storeu_si128((__m128i*)(pixels + i), r);
+		}
+		map_masked_scalar(pixels + i, mask + i, count - i, table);
+	}
+
+	EXPLOR_TARGET("avx2")
+	inline __m256i lookup_avx2(__m256i v, __m256i t0, __m256i t1, __m256i t2) {
+		const __m256i bias = _mm256_set1_epi8(0x70);
+		__m256i r0 = _mm256_shuffle_epi8(t0, _mm256_adds_epu8(v, bias));
+		__m256i r1 = _mm256_shuffle_epi8(t1, _mm256_adds_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(16)), bias));
+		__m256i r2 = _mm256_shuffle_epi8(t2, _mm256_adds_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(32)), bias));
+		return _mm256_or_si256(_mm256_or_si256(r0, r1), r2);
+	}
+
+	//The shuffle works per 128 bit lane so every table part is repeated in both lanes
+	EXPLOR_TARGET("avx2")
+	inline void load_table_avx2(char const* table, __m256i& t0, __m256i& t1, __m256i& t2) {
+		char padded[48] = { 0 };
+		for (std::size_t i = 0; i < 36; i++) padded[i] = table[i];
+		t0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)padded));
+		t1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)(padded + 16)));
+		t2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)(padded + 32)));
+	}
+
+	EXPLOR_TARGET("avx2")
+	inline void map_avx2(char* pixels, std::size_t count, char const* table) {
+		__m256i t0, t1, t2;
+		load_table_avx2(table, t0, t1, t2);
+
+		std::size_t i = 0;
+		for (; i + 32 <= count; i += 32) {
+			__m256i v = _mm256_loadu_si256((__m256i const*)(pixels + i));
+			_mm256_storeu_si256((__m256i*)(pixels + i), lookup_avx2(v, t0, t1, t2));
+		}
+		map_scalar(pixels + i, count - i, table);
+	}
+
+	EXPLOR_TARGET("avx2")
+	inline void map_masked_avx2(char* pixels, char const* mask, std::size_t count, char const* table) {
+		__m256i t0, t1, t2;
+		load_table_avx2(table, t0, t1, t2);
+
+		std::size_t i = 0;
+		for (; i + 32 <= count; i += 32) {
+			__m256i v = _mm256_loadu_si256((__m256i const*)(pixels + i));
+			__m256i m = _mm256_loadu_si256((__m256i const*)(mask + i));
+			__m256i r = _mm256_blendv_epi8(v, lookup_avx2(v, t0, t1, t2), m);
+			_mm256_storeu_si256((__m256i*)(pixels + i), r);
+		}
+		map_masked_scalar(pixels + i, mask + i, count - i, table);
+	}
+
+	EXPLOR_TARGET("avx2")
+	inline bool pack_avx2(char const* pixels, std::size_t count, char const* table, std::uint8_t* out) {
+		__m256i t0, t1, t2;
+		load_table_avx2(table, t0, t1, t2);
+		const __m256i one = _mm256_set1_epi8(1);
+		const __m256i high = _mm256_set1_epi8((char)0xFE);
+		//movemask puts the first byte in the lowest bit, PBM wants it in the top bit of every byte
+		const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+		std::size_t i = 0;
+		for (; i + 32 <= count; i += 32) {
+			__m256i v = lookup_avx2(_mm256_loadu_si256((__m256i const*)(pixels + i)), t0, t1, t2);
+			if (!_mm256_testz_si256(v, high)) return false;
+			std::uint32_t bits = (std::uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_shuffle_epi8(v, reverse), one));
+			std::memcpy(out + i / 8, &bits, 4);
+		}
+		return pack_scalar(pixels + i, count - i, table, out + i / 8);
+	}
+
+	enum class ISA {
+		SCALAR,
+		SSE41,
+		AVX2
+	};
+
+	inline ISA detect_isa() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int ids = info[0];
+		if (ids < 1) return ISA::SCALAR;
+
+		__cpuidex(info, 1, 0);
+		bool ssse3 = (info[2] & (1 << 9)) != 0;
+		bool sse41 = (info[2] & (1 << 19)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		bool avx2 = false;
+		if (ids >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		bool ssse3 = __builtin_cpu_supports("ssse3");
+		bool sse41 = __builtin_cpu_supports("sse4.1");
+		bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+		if (avx2) return ISA::AVX2;
+		if (ssse3 && sse41) return ISA::SSE41;
+		return ISA::SCALAR;
+	}
+
+#else
+
+	enum class ISA {
+		SCALAR
+	};
+
+	inline ISA detect_isa() { return ISA::SCALAR; }
+
+#endif
+
+	inline ISA active_isa() {
+		static const ISA isa = detect_isa();
+		return isa;
+	}
+
+	inline MapFunction select_map() {
+		switch (active_isa()) {
+#ifdef EXPLOR_X86
+		case ISA::AVX2: return map_avx2;
+		case ISA::SSE41: return map_ssse3;
+#endif
+		default: return map_scalar;
+		}
+	}
+
+	inline MaskedMapFunction select_map_masked() {
+		switch (active_isa()) {
+#ifdef EXPLOR_X86
+		case ISA::AVX2: return map_masked_avx2;
+		case ISA::SSE41: return map_masked_sse41;
+#endif
+		default: return map_masked_scalar;
+		}
+	}
+
+	inline PackFunction select_pack() {
+		switch (active_isa()) {
+#ifdef EXPLOR_X86
+		case ISA::AVX2: return pack_avx2;
+#endif
+		default: return pack_scalar;
+		}
+	}
+
+	inline void map(char* pixels, std::size_t count, char const* table) {
+		static const MapFunction selected = select_map();
+		selected(pixels, count, table);
+	}
+
+	//Mask bytes must be either 0 or -1 ( all bits set )
+	inline void map_masked(char* pixels, char const* mask, std::size_t count, char const* table) {
+		static const MaskedMapFunction selected = select_map_masked();
+		selected(pixels, mask, count, table);
+	}
+
+	inline bool pack(char const* pixels, std::size_t count, char const* table, std::uint8_t* out) {
+		static const PackFunction selected = select_pack();
+		return selected(pixels, count, table, out);
+	}
+
+	//One bit per pixel, every row is padded to whole 64 bit words
+	struct BitPlane {
+		std::size_t width{ 0 };
+		std::size_t height{ 0 };
+		std::size_t words{ 0 };
+		std::vector<std::uint64_t> bits;
+
+		void reset(std::size_t w, std::size_t h) {
+			width = w;
+			height = h;
+			words = (w + 63) / 64;
+			bits.assign(words * h, 0);
+		}
+
+		std::uint64_t* row(std::size_t r) { return bits.data() + r * words; }
+		std::uint64_t const* row(std::size_t r) const { return bits.data() + r * words; }
+
+		void set(std::size_t r, std::size_t c, bool value) {
+			std::uint64_t mask = std::uint64_t(1) << (c & 63);
+			if (value) row(r)[c >> 6] |= mask;
+			else row(r)[c >> 6] &= ~mask;
+		}
+	};
+
+	inline bool test_bit(std::uint64_t const* row, std::size_t i) {
+		return (row[i >> 6] >> (i & 63)) & 1;
+	}
+
+	//Index of the lowest set bit, the word must not be 0
+	inline unsigned lowest_bit(std::uint64_t word) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return index;
+#elif defined(__GNUC__) || defined(__clang__)
+		return (unsigned)__builtin_ctzll(word);
+#else
+		unsigned index = 0;
+		for (; !(word & 1); word >>= 1) index++;
+		return index;
+#endif
+	}
+
+	//visit(i) for every set bit i of a row of width bits, lowest first
+	template<typename Visit>
+	inline void for_each_set_bit(std::uint64_t const* row, std::size_t width, Visit&& visit) {
+		std::size_t words = (width + 63) / 64;
+		for (std::size_t w = 0; w < words; w++) {
+			std::uint64_t bits = row[w];
+			if (w + 1 == words && (width & 63)) bits &= (std::uint64_t(1) << (width & 63)) - 1;
+			while (bits) {
+				visit(w * 64 + lowest_bit(bits));
+				bits &= bits - 1;
+			}
+		}
+	}
+
+	/*
+		Column j of out gets column j + shift ( -1, 0 or 1 ) of in.
+		The column that falls outside of the row gets leftEdge ( for -1 at column 0 )
+		or rightEdge ( for 1 at the last column ) so any edge rule can be used
+	*/
+	inline void shift_row(std::uint64_t const* in, std::uint64_t* out, std::size_t width, int shift,
+		bool leftEdge, bool rightEdge) {
+		std::size_t words = (width + 63) / 64;
+
+		if (shift == 0) {
+			for (std::size_t w = 0; w < words; w++) out[w] = in[w];
+		}
+		else if (shift < 0) {
+			for (std::size_t w = 0; w < words; w++) {
+				out[w] = (in[w] << 1) | (w > 0 ? in[w - 1] >> 63 : 0);
+			}
+			out[0] = (out[0] & ~std::uint64_t(1)) | (std::uint64_t)leftEdge;
+		}
+		else {
+			for (std::size_t w = 0; w < words; w++) {
+				out[w] = (in[w] >> 1) | (w + 1 < words ? in[w + 1] << 63 : 0);
+			}
+			std::size_t last = width - 1;
+			std::uint64_t mask = std::uint64_t(1) << (last & 63);
+			out[last >> 6] = (out[last >> 6] & ~mask) | ((std::uint64_t)rightEdge << (last & 63));
+		}
+
+		//Keep the padding clear
+		if (width & 63) out[words - 1] &= (std::uint64_t(1) << (width & 63)) - 1;
+	}
+
+	/*
+		Bit sliced counter for a row of pixels, bit b of every column's count is kept in slices[b]
+		so adding a row of 0/1 values is a ripple carry over whole words
+	*/
+	struct BitCounter {
+		std::size_t words{ 0 };
+		std::size_t bits{ 0 };
+		std::size_t limit{ 0 };
+		std::vector<std::uint64_t> slices;
+
+		//Prepare for counting up to max_count over width columns
+		void reset(std::size_t width, std::size_t max_count) {
+			words = (width + 63) / 64;
+			limit = max_count;
+			bits = 0;
+			while ((std::size_t(1) << bits) <= max_count) bits++;
+			slices.assign(words * bits, 0);
+		}
+
+		void clear() {
+			std::fill(slices.begin(), slices.end(), 0);
+		}
+
+		void add(std::uint64_t const* row) {
+			for (std::size_t w = 0; w < words; w++) {
+				std::uint64_t carry = row[w];
+				for (std::size_t b = 0; b < bits && carry; b++) {
+					std::uint64_t& slice = slices[b * words + w];
+					std::uint64_t next = slice & carry;
+					slice ^= carry;
+					carry = next;
+				}
+			}
+		}
+
+		//Or into out the columns whose count equals n
+		void match(std::size_t n, std::uint64_t* out) const {
+			if (n > limit) return;
+			for (std::size_t w = 0; w < words; w++) {
+				std::uint64_t eq = ~std::uint64_t(0);
+				for (std::size_t b = 0; b < bits; b++) {
+					std::uint64_t slice = slices[b * words + w];
+					eq &= ((n >> b) & 1) ? slice : ~slice;
+				}
+				out[w] |= eq;
+			}
+		}
+	};
+
+}
@@ -1,71 +1,142 @@
 #pragma once
 
 #include "ExplorTypes.h"
+#include "ExplorKernels.h"
+#include "ExplorThreads.h"
+#include "ExplorRandom.h"
+#include "ExplorFrames.h"
 
 
 
 
-template<std::size_t W = 340,std::size_t H= 240>
 class EXPLOR {
 	
 
-	static constexpr std::size_t Width = W;
-	static constexpr std::size_t Height = H;
+	const std::size_t Width;
+	const std::size_t Height;
 
-	using ImageBuffer = std::array<std::array<char, Width>, Height>;
-	using ImageBitmap = std::array<std::array<bool, Width>, Height>;
+	using ImageBuffer = Canvas;
 
 
 	std::vector<std::size_t> executeCounter;
 	std::map<std::string, int> namedMap;
+	std::vector<Instruction> program;
+	std::unordered_map<std::string, int> variableSlots;
+	std::vector<int> variables;
+	std::vector<char> eventMask;
+	std::vector<kernels::BitPlane> occupancy;
+	kernels::BitCounter counter;
+	std::vector<std::ptrdiff_t> neighbourOffsets;
+	std::vector<char> bandRows;
+	std::unique_ptr<TilePool> pool;
 
 	char tTable[36] = { 0 };
 	std::size_t pc = 0;
 	int nextCounter = 0;
 	int after_coroutine = -1;
 
-	std::map<std::string, PatternContainer> patterns;
+	//Lines refer to patterns by slot index, which stays the same while the vector grows.
+	//Slots are only added by addLine() and compile(), pointers from resolvePattern() are good from then on
+	std::vector<std::optional<PatternContainer>> patterns;
+	std::unordered_map<std::string, int> patternSlots;
+	std::uint64_t patternEdits = 0;
+
+	//Boxes of the box commands by line, worked out again when their inputs change
+	std::vector<StampCache> stamps;
+	static constexpr std::size_t maxStampSpans = 1 << 20;
+	//Level of the last box over every pixel while leveling, all zero between two levelings
+	std::vector<std::uint32_t> stampLevels;
 	
 
-	WrapMode wrap_mode;
-	RenderMode render_mode;
-	NeighbourhoodMode neighbourhood_mode;
+	WrapMode wrap_mode = WrapMode::WRP;
+	RenderMode render_mode = RenderMode::RUN;
+	NeighbourhoodMode neighbourhood_mode = NeighbourhoodMode::SQR;
+	UpdateMode update_mode = UpdateMode::INP;
 
-	//Randomizer components
-	std::mt19937 gen;
-	std::uniform_real_distribution<> dis;
+	//CAMERA packs every frame into shot and hands it to the sink, without one they are all kept
+	Frame shot;
+	FrameStore store;
+	FrameSink* sink = &store;
+
+	//Neighbour commands write here, the image itself unless updating synchronously
+	ImageBuffer backBuffer;
+	ImageBuffer* output = nullptr;
+
+	//Randomizer components, draws are keyed by the line being executed
+	std::uint64_t seed = 0;
+	rng::Stream draws;
+	std::uint64_t sequence = 0;
 
 public:
 
 	std::vector<Command> commands;
-	std::vector<ImageBitmap> frames;
-	std::map<std::string, int> variables;
-	std::string lastPattern;
 	ImageBuffer imageBuffer;
+	std::string lastPattern;
 
-	EXPLOR() {
-		for (size_t i = 0; i < Height; i++)
-		{
-			std::fill(std::begin(imageBuffer[i]), std::end(imageBuffer[i]), '0');
-		}
+	//Largest side of the image, keeps Width * Height and the halo within 32 bits
+	static constexpr std::size_t maxSide = 1 << 15;
+	//Most worker threads the image commands are split across
+	static constexpr std::size_t maxThreads = 256;
+
+	//No thread count takes one per hardware thread
+	EXPLOR(std::size_t width = 320, std::size_t height = 240, std::size_t threads = 0)
+		:Width(checkedSide(width)), Height(checkedSide(height)), imageBuffer(Width, Height),
+		pool(std::make_unique<TilePool>(clampThreads(threads == 0 ? std::thread::hardware_concurrency() : threads))) {
 
-		auto seed = (unsigned int)std::chrono::high_resolution_clock::now().time_since_epoch().count() ^ std::random_device()();
-		gen = std::mt19937(seed); //Generate seed 
-		dis = std::uniform_real_distribution<double>(0, 1); // Select Distribution
+		output = &imageBuffer;
+
+		seed = (std::uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count() ^ std::random_device()(); //Generate seed 
 	};
 
+	std::size_t width() const { return Width; }
+	std::size_t height() const { return Height; }
+
+	//Width and Height come first, a bad side throws before the canvas or the threads exist
+	static std::size_t checkedSide(std::size_t side) {
+		if (side == 0 || side > maxSide) {
+			throw std::exception{ "Image dimensions must be positive and at most maxSide" };
+		}
+		return side;
+	}
+
+	static std::size_t clampThreads(std::size_t threads) {
+		return std::min(std::max<std::size_t>(threads, 1), maxThreads);
+	}
+
+	//Number of threads the whole image commands are split across
+	void setThreads(std::size_t threads) {
+		pool = std::make_unique<TilePool>(clampThreads(threads));
+	}
+	std::size_t threads() const { return pool->size(); }
+
+	//The same seed gives the same images whatever the thread count
+	void setSeed(std::uint64_t s) { seed = s; }
+
+	//Next of the draws the line makes one after another
 	bool hasEventOccured(unsigned int prob) {
-		return prob == 1 || dis(gen) <= 1.0 / prob;
+		return draws.event(rng::Purpose::SEQUENCE, sequence++, prob);
 	}
 
-	bool outOfBound(std::pair<int, int> coords) {
-		
-		if ((coords.first < 0 || coords.first > Height) &&
-			(coords.second < 0 || coords.second > Width)) {
-			return true;
-		}
+	double nextUniform() {
+		return draws.uniform(rng::Purpose::SEQUENCE, sequence++);
+	}
 
-		return false;
+	//The draw of a pixel of a whole image command, boxes draw further on in the stream
+	bool hasEventOccured(unsigned int prob, std::size_t x, std::size_t y) const {
+		return draws.event(rng::Purpose::PIXEL, x * Width + y, prob);
+	}
+
+	//Frames go to the sink as they are taken instead of being kept, nullptr keeps them again
+	void setFrameSink(FrameSink* s) { sink = s ? s : &store; }
+
+	//The frames kept while there is no sink
+	std::vector<Frame> const& frames() const { return store.frames; }
+
+	//Read a variable by name, meant for inspecting the state after a run
+	std::optional<int> variable(std::string const& name) const {
+		auto res = variableSlots.find(name);
+		if (res == variableSlots.end()) return std::nullopt;
+		return variables[res->second];
 	}
 
 	bool validateCommand(const Command& cmd){
@@ -78,24 +149,26 @@ public:
 		std::visit(overloaded{
 			[&label,this](Pattern& p) {
 				if (label.length() == 0) {
-					patterns.find(lastPattern)->second.data.push_back(p);
-					patterns.find(lastPattern)->second.rows++;
-					//Throw if last pattern is invalid
+					auto& last = patterns[patternSlot(lastPattern)];
+					if (!last) {
+						throw std::exception{ "Pattern row without a pattern label" };
+					}
+					last->append(p);
+					last->version = ++patternEdits;
 				}
 				else {
 					PatternContainer temp;
-					temp.data.push_back(p);
-					temp.rows = 1;
-					temp.cols = p.size();
-					patterns.emplace(std::make_pair(label,std::move(temp)));
-					lastPattern = label;
+					temp.append(p);
+					temp.version = ++patternEdits;
+					patterns[patternSlot(label)] = std::move(temp);
+					lastPattern = std::move(label);
 				}
 			},
 			[&label,this](Command& c) {
-				commands.push_back(c);
+				commands.push_back(std::move(c));
 				executeCounter.push_back(1);
 				if (!label.empty())
-					namedMap.emplace(std::make_pair(label,commands.size() - 1));
+					namedMap.emplace(std::make_pair(std::move(label),commands.size() - 1));
 			},
 
 			}, cmd);
@@ -103,108 +176,362 @@ public:
 	};
 
 
-	std::pair<int, int> getNeighbour(char dir, std::size_t offset, std::size_t x, std::size_t y, bool overlap = false) {
-		int xN = 0, yN = 0;
-		switch (dir)
-		{
-		case 'W': {
-			xN = x - offset; yN = y - offset; break;
-		}
-		case 'A': {
-			xN = x; yN = y - offset; break;
-		}
-		case 'N': {
-			xN = x + offset; yN = y - offset; break;
+	void refreshHalo() {
+		if (wrap_mode == WrapMode::WRP) imageBuffer.wrapHalo();
+		else imageBuffer.clearHalo();
+	}
+
+	//Write a pixel of a neighbour command, in place it keeps the halo valid for the rest of it
+	void writePixel(std::size_t x, std::size_t y, char value) {
+		(*output)[x][y] = value;
+		if (output == &imageBuffer && wrap_mode == WrapMode::WRP) imageBuffer.mirror(x, y);
+	}
+
+	bool synchronous() const { return update_mode == UpdateMode::SYN; }
+
+	//Point neighbour commands at the back buffer, copied from the image unless every pixel gets written
+	void beginUpdate(bool copy) {
+		if (!synchronous()) return;
+		if (backBuffer.width != Width || backBuffer.height != Height) backBuffer = ImageBuffer(Width, Height);
+		if (copy) backBuffer.copyFrom(imageBuffer);
+		output = &backBuffer;
+	}
+
+	//Swap the finished back buffer in, only the pixel pointers move
+	void endUpdate() {
+		if (!synchronous()) return;
+		std::swap(imageBuffer, backBuffer);
+		output = &imageBuffer;
+	}
+
+	//Events of every pixel, the same draws the per pixel translations make
+	void drawEvents(int prob) {
+		eventMask.resize(Width * Height);
+		forEachBand(Height, Width, [prob, this](std::size_t begin, std::size_t end) {
+			draws.events(rng::Purpose::PIXEL, begin * Width, (end - begin) * Width, prob, eventMask.data() + begin * Width);
+		});
+	}
+
+	//Pointer offsets to the neighbours in the given directions, unknown directions are skipped
+	void prepareNeighbours(std::vector<char> const& dirs) {
+		std::ptrdiff_t row = (std::ptrdiff_t)imageBuffer.stride;
+		neighbourOffsets.clear();
+		for (char d : dirs) {
+			switch (d)
+			{
+			case 'W': neighbourOffsets.push_back(-row - 1); break;
+			case 'A': neighbourOffsets.push_back(-1); break;
+			case 'N': neighbourOffsets.push_back(row - 1); break;
+			case 'R': neighbourOffsets.push_back(row); break;
+			case 'E': neighbourOffsets.push_back(row + 1); break;
+			case 'B': neighbourOffsets.push_back(1); break;
+			case 'S': neighbourOffsets.push_back(-row + 1); break;
+			case 'L': neighbourOffsets.push_back(-row); break;
+			default:
+				break;
+			}
 		}
-		case 'R': {
-			xN = x + offset; yN = y; break;
+	}
+
+	//Set up the halo and the neighbour offsets before a transform runs
+	void prepare(XL const& t) {}
+
+	void prepare(AXL const& t) {
+		refreshHalo();
+		prepareNeighbours(t.directions);
+	}
+
+	void prepare(PXL const& t) {
+		refreshHalo();
+		prepareNeighbours(std::vector<char>{ t.dir });
+	}
+
+	std::size_t countNeighbours(std::size_t x, std::size_t y, char value) {
+		char const* pixel = &imageBuffer[x][y];
+		std::size_t count = 0;
+		for (std::ptrdiff_t offset : neighbourOffsets) {
+			count += (pixel[offset] == value);
 		}
-		case 'E': {
-			xN = x + offset; yN = y + offset; break;
+
+		return count;
+	}
+
+	bool inRegion(std::size_t x, std::size_t y, std::vector<char> const& nums, std::vector<char> const& pxls) {
+		for (const char& p : pxls) {
+			std::size_t count = countNeighbours(x, y, (char)pxl_to_index(p));
+			//This should not be really needed ( should be numbers beforehand in the parsing/init of the language )
+			for (const char& n : nums) {
+				if ((std::size_t)(n - '0') == count) return true;
+			}
 		}
-		case 'B': {
-			xN = x; yN = y + offset; break;
+		return false;
+		
+	}
+
+	/*
+		Whole image AXL using bit sliced neighbour counting.
+		Every tested pixel value gets an occupancy plane, the counts of a whole row are
+		then built 64 pixels at a time by adding shifted plane rows.
+		In place the translation is applied in scan order, pixels whose left neighbour
+		( or first pixel for the wrapping B direction ) changed earlier in the same row are recounted
+	*/
+	void mapRegion(AXL const& t) {
+		auto prob = resolveVariable(t.prob);
+		if (!prob) return;
+
+		prepare(t);
+
+		if (sparse(t, prob.value())) {
+			mapSparse(t, prob.value());
+			return;
 		}
-		case 'S': {
-			xN = x - offset; yN = y + offset; break;
+
+		bool wrap = wrap_mode == WrapMode::WRP;
+		//A single wrapping row or column is its own neighbour
+		if (!synchronous() && wrap && (Height == 1 || Width == 1)) {
+			forEachPixel([&t, this](int x, int y, char value) {
+				translation(x, y, t);
+			});
+			return;
 		}
-		case 'L': {
-			xN = x - offset; yN = y; break;
+
+		std::vector<char> symbols;
+		for (char p : t.values) {
+			char s = (char)pxl_to_index(p);
+			if (std::find(symbols.begin(), symbols.end(), s) == symbols.end()) symbols.push_back(s);
 		}
 
-		default:
-			break;
+		std::vector<std::size_t> counts;
+		for (char n : t.numbers) counts.push_back((std::size_t)(n - '0'));
+
+		occupancy.resize(symbols.size());
+		for (std::size_t s = 0; s < symbols.size(); s++) occupancy[s].reset(Width, Height);
+		forEachBand(Height, Width, [&symbols, this](std::size_t begin, std::size_t end) {
+			for (std::size_t s = 0; s < symbols.size(); s++)
+				for (std::size_t i = begin; i < end; i++)
+					for (std::size_t j = 0; j < Width; j++)
+						if (imageBuffer[i][j] == symbols[s]) occupancy[s].set(i, j, true);
+		});
+
+		if (synchronous()) {
+			mapRegionSync(t, prob.value(), counts);
+			return;
 		}
-		
-		if (overlap) {
-			return { xN % Height, yN % Width };
+
+		if (prob.value() != 1) drawEvents(prob.value());
+
+		std::size_t words = (Width + 63) / 64;
+		std::vector<std::uint64_t> shifted(words), region(words), empty(words);
+		counter.reset(Width, neighbourOffsets.size());
+
+		bool leftDependent = std::find(t.directions.begin(), t.directions.end(), 'A') != t.directions.end();
+		bool wrapDependent = wrap && std::find(t.directions.begin(), t.directions.end(), 'B') != t.directions.end();
+
+		for (std::size_t i = 0; i < Height; i++) {
+			countRow(i, t.directions, counts, counter, shifted.data(), region.data(), empty.data());
+
+			bool previousChanged = false;
+			bool firstChanged = false;
+			for (std::size_t j = 0; j < Width; j++) {
+				bool changed = false;
+
+				if (prob.value() == 1 || eventMask[i * Width + j]) {
+					bool stale = (leftDependent && previousChanged) || (wrapDependent && j == Width - 1 && firstChanged);
+					bool inside = stale ? inRegion(i, j, t.numbers, t.values) : kernels::test_bit(region.data(), j);
+
+					if (inside) {
+						char old = imageBuffer[i][j];
+						char value = t.translation[old];
+						if (value != old) {
+							writePixel(i, j, value);
+							for (std::size_t s = 0; s < symbols.size(); s++) {
+								if (old == symbols[s]) occupancy[s].set(i, j, false);
+								if (value == symbols[s]) occupancy[s].set(i, j, true);
+							}
+							changed = true;
+						}
+					}
+				}
+
+				previousChanged = changed;
+				if (j == 0) firstChanged = changed;
+			}
 		}
-		
-		return { xN,yN };
-		
 	}
 
-	
-	std::size_t countNeighbours(std::size_t x, std::size_t y, std::vector<char> dirs, std::size_t offset, char value) {
-		std::size_t count = 0;
-		for (const char& d : dirs) {
-			auto [xn, yn] = getNeighbour(d, 1, x, y, this->wrap_mode == WrapMode::WRP);
-			if (!outOfBound({ xn, yn })) {
-				count += (imageBuffer.at(xn).at(yn) == value);
+	//Mark in region the pixels of row i where any occupancy plane has one of the counts around it
+	void countRow(std::size_t i, std::vector<char> const& directions, std::vector<std::size_t> const& counts,
+		kernels::BitCounter& counter, std::uint64_t* shifted, std::uint64_t* region, std::uint64_t const* empty) const {
+		bool wrap = wrap_mode == WrapMode::WRP;
+		std::ptrdiff_t above = i == 0 ? (wrap ? (std::ptrdiff_t)Height - 1 : -1) : (std::ptrdiff_t)i - 1;
+		std::ptrdiff_t below = i + 1 == Height ? (wrap ? 0 : -1) : (std::ptrdiff_t)i + 1;
+
+		std::fill(region, region + (Width + 63) / 64, 0);
+		for (std::size_t s = 0; s < occupancy.size(); s++) {
+			counter.clear();
+			for (char d : directions) {
+				std::ptrdiff_t row = i;
+				int shift = 0;
+				switch (d)
+				{
+				case 'W': row = above; shift = -1; break;
+				case 'A': shift = -1; break;
+				case 'N': row = below; shift = -1; break;
+				case 'R': row = below; break;
+				case 'E': row = below; shift = 1; break;
+				case 'B': shift = 1; break;
+				case 'S': row = above; shift = 1; break;
+				case 'L': row = above; break;
+				default:
+					continue;
+				}
+
+				std::uint64_t const* source = row < 0 ? empty : occupancy[s].row(row);
+				bool leftEdge = wrap && kernels::test_bit(source, Width - 1);
+				bool rightEdge = wrap && kernels::test_bit(source, 0);
+				kernels::shift_row(source, shifted, Width, shift, leftEdge, rightEdge);
+				counter.add(shifted);
 			}
+			for (std::size_t n : counts) counter.match(n, region);
 		}
-
-		return count;
 	}
 
-	bool inRegion(std::size_t x, std::size_t y, std::vector<char> dirs, std::vector<char> nums, std::vector<char> pxls) {
-		std::vector<std::size_t> n;
-		//This should not be really needed ( should be numbers beforehand in the parsing/init of the language )
-		std::transform(nums.cbegin(), nums.cend(), std::back_inserter(n), [](const char& n) ->std::size_t { return n - '0'; });
-		std::sort(n.begin(), n.end());
+	//Every row reads the planes of the unchanged image and writes the back buffer, so bands run at once
+	void mapRegionSync(AXL const& t, int prob, std::vector<std::size_t> const& counts) {
+		if (prob != 1) drawEvents(prob);
+		beginUpdate(false);
+
+		char const* table = t.translation.table.data();
+		forEachBand(Height, Width, [&t, prob, &counts, table, this](std::size_t begin, std::size_t end) {
+			std::size_t words = (Width + 63) / 64;
+			std::vector<std::uint64_t> shifted(words), region(words), empty(words);
+			std::vector<char> mask(Width);
+			kernels::BitCounter bandCounter;
+			bandCounter.reset(Width, neighbourOffsets.size());
+
+			for (std::size_t i = begin; i < end; i++) {
+				countRow(i, t.directions, counts, bandCounter, shifted.data(), region.data(), empty.data());
+				char const* events = prob == 1 ? nullptr : eventMask.data() + i * Width;
+				for (std::size_t j = 0; j < Width; j++) {
+					mask[j] = kernels::test_bit(region.data(), j) && (!events || events[j]) ? -1 : 0;
+				}
 
-		
-		for (const char& p : pxls) {
-			//only because it returns t/f and looks cleaner
-			if (std::binary_search(n.begin(), n.end(), countNeighbours(x, y, dirs, 1, p))) {
-				return true;
+				std::copy_n(imageBuffer[i], Width, backBuffer[i]);
+				kernels::map_masked(backBuffer[i], mask.data(), Width, table);
 			}
-		}
-		return false;
-		
+		});
+
+		endUpdate();
 	}
 
-	void forEachPixel(std::function<void(std::size_t, std::size_t, char)> transform) {
-		for (size_t i = 0; i < Height; i++)
-		{
-			for (size_t j = 0; j < Width; j++)
+	//Whole image PXL in synchronous mode, one table lookup per pixel from the unchanged image
+	void mapNeighbourSync(PXL const& t) {
+		if (t.prob != 1) drawEvents(t.prob);
+		if (neighbourOffsets.empty()) return;
+		beginUpdate(false);
+
+		std::ptrdiff_t offset = neighbourOffsets[0];
+		forEachBand(Height, Width, [&t, offset, this](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++) {
+				char const* events = t.prob == 1 ? nullptr : eventMask.data() + i * Width;
+				char const* pixels = imageBuffer[i];
+				char* out = backBuffer[i];
+				for (std::size_t j = 0; j < Width; j++) {
+					char const* pixel = pixels + j;
+					out[j] = !events || events[j] ? t.translation(pixel[offset], *pixel) : *pixel;
+				}
+			}
+		});
+
+		endUpdate();
+	}
+
+	//Split rows [0, rows) of a region width pixels wide into bands across the pool
+	//Small regions stay on the calling thread, the hand off costs more than the work
+	void forEachBand(std::size_t rows, std::size_t width, TilePool::Task const& task) {
+		std::size_t minRows = (4096 + width - 1) / width;
+		pool->run(rows, std::max(pool->grain(rows), minRows), task);
+	}
+
+	//The band size forEachBand uses, for work that has to know the band edges up front
+	std::size_t bandSize(std::size_t rows, std::size_t width) const {
+		std::size_t minRows = (4096 + width - 1) / width;
+		return std::max(pool->size() == 1 ? rows : pool->grain(rows), minRows);
+	}
+
+	//Independent transforms only touch their own pixel and draw no random numbers, so rows can run at once
+	void forEachPixel(std::function<void(std::size_t, std::size_t, char)> transform, bool independent = false) {
+		auto rows = [&transform, this](std::size_t begin, std::size_t end) {
+			for (size_t i = begin; i < end; i++)
 			{
-				transform(i, j, imageBuffer[i][j]);
+				for (size_t j = 0; j < Width; j++)
+				{
+					transform(i, j, imageBuffer[i][j]);
+				}
 			}
-		}
+		};
+
+		if (independent) forEachBand(Height, Width, rows);
+		else rows(0, Height);
 	}
 
-	void forEachPixelIn(std::function<void(std::size_t, std::size_t, char)> transform, Rectangle rect) {
-		for (size_t i = rect.x; i < rect.xM; i++)
-		{
+	void forEachPixelIn(std::function<void(std::size_t, std::size_t, char)> transform, Rectangle rect, bool independent = false) {
+		forEachRowIn([&transform, &rect, this](std::size_t r, std::size_t oX) {
+			std::size_t oY = rect.y % Width;
 			for (size_t j = rect.y; j < rect.yM; j++)
 			{
-				//if (i % Height != i || j % Width != j) continue;
-				auto [oX, oY] = std::pair( i % Height, j % Width );	
 				transform(oX, oY, imageBuffer[oX][oY]);
+				if (++oY == Width) oY = 0;
 			}
-		}
+		}, rect, independent);
+	}
+
+	//Rows of a rectangle as ( row of the rectangle, row of the image )
+	template<typename Row>
+	void forEachRowIn(Row&& row, Rectangle rect, bool independent = false) {
+		auto rows = [&row, &rect, this](std::size_t begin, std::size_t end) {
+			for (size_t r = begin; r < end; r++)
+			{
+				row(r, (rect.x + r) % Height);
+			}
+		};
 
+		std::size_t height = rect.xM > rect.x ? rect.xM - rect.x : 0;
+		std::size_t width = rect.yM > rect.y ? rect.yM - rect.y : 0;
+		//Taller than the image means some rows come around twice, keep those in order
+		if (independent && height <= Height && width != 0) forEachBand(height, width, rows);
+		else rows(0, height);
 	}
 
+	//Rows of a rectangle in contiguous pieces ( row of the image, first column, length ), split where they wrap around
+	template<typename Span>
+	void forEachSpanIn(Span&& span, Rectangle rect, bool independent = false) {
+		std::size_t width = rect.yM > rect.y ? rect.yM - rect.y : 0;
+		if (width == 0) return;
+		forEachRowIn([&span, &rect, width, this](std::size_t r, std::size_t x) {
+			std::size_t y = rect.y % Width;
+			for (std::size_t left = width; left > 0; y = 0) {
+				std::size_t length = std::min(left, Width - y);
+				span(x, y, length);
+				left -= length;
+			}
+		}, rect, independent);
+	}
+
+	//Whether a transform can be split with forEachPixel(In)
+	//Neighbour commands can only when they read the image as it was
+	bool independent(XL const& t) const { return true; }
+	bool independent(AXL const& t) const { return synchronous(); }
+	bool independent(PXL const& t) const { return synchronous(); }
+
 	template<typename T>
 	void translation(int x, int y, T const& t) { };
 
 	template<>
 	void translation<XL>(int x, int y, XL const& t) {
 
-		if (hasEventOccured(t.prob))
-			imageBuffer[x][y] = t.translation.transform(imageBuffer[x][y]);
+		if (hasEventOccured(t.prob, x, y))
+			apply(x, y, t);
 	};
 
 	template<>
@@ -212,80 +539,420 @@ public:
 		// Test the event first so we reduce the amount of "heavy" compute in inRegion
 		auto prob = resolveVariable(t.prob);
 		if (prob) {
-			if (hasEventOccured(prob.value()) && inRegion(x, y, t.directions, t.numbers, t.values)) {
-				imageBuffer[x][y] = t.translation.transform(imageBuffer[x][y]);
+			if (hasEventOccured(prob.value(), x, y)) {
+				apply(x, y, t);
 			}
 		}
 	};
 
 	template<>
 	void translation<PXL>(int x, int y, PXL const& t) {
-		auto [xn, yn] = getNeighbour(t.dir, 1, x, y, true);
+		if (hasEventOccured(t.prob, x, y)) {
+			apply(x, y, t);
+		}
+	};
 
-		if (hasEventOccured(t.prob) && 
-			!outOfBound({ xn, yn })) {
+	//What a transform does to a pixel once its event happened
+	void apply(std::size_t x, std::size_t y, XL const& t) {
+		imageBuffer[x][y] = t.translation[imageBuffer[x][y]];
+	}
 
-			imageBuffer[x][y] = t.translation.transform(imageBuffer[xn][yn], imageBuffer[x][y]);
+	void apply(std::size_t x, std::size_t y, AXL const& t) {
+		if (inRegion(x, y, t.numbers, t.values)) {
+			writePixel(x, y, t.translation[imageBuffer[x][y]]);
 		}
-	};
+	}
 
-	template<typename TForm,
-		typename = std::enable_if_t<in_transform_group<TForm>>>
-		void applyPattern(Rectangles const& rect, PatternContainer const& pat, TForm const& tform) {
-		for (std::size_t c = 0; c < rect.c; c++)
-		{
-			for (std::size_t r = 0; r < rect.r; r++)
+	void apply(std::size_t x, std::size_t y, PXL const& t) {
+		if (!neighbourOffsets.empty()) {
+			char const* pixel = &imageBuffer[x][y];
+			writePixel(x, y, t.translation(pixel[neighbourOffsets[0]], *pixel));
+		}
+	}
+
+	//Probability of the per pixel events, nothing when the command does not run at all
+	std::optional<int> eventProbability(XL const& t) { return t.prob; }
+	std::optional<int> eventProbability(AXL const& t) { return resolveVariable(t.prob); }
+	std::optional<int> eventProbability(PXL const& t) { return t.prob; }
+
+	/*
+		From these probabilities on the events are found by jumping from one straight to the next.
+		Each is the first one bench/SparseCrossover.cpp found the jumps faster at, a jump costs
+		about as much as 8 pixels of the dense neighbour commands or 48 of the vectorized XL.
+		Run it again when the kernels or the randomizer change
+	*/
+	static constexpr unsigned int sparseFromXL = 48;
+	static constexpr unsigned int sparseFromAXL = 8;
+	static constexpr unsigned int sparseFromPXL = 10;
+
+	//Thresholds in use, only the benchmark moves them
+	struct SparseFrom {
+		unsigned int xl = sparseFromXL;
+		unsigned int axl = sparseFromAXL;
+		unsigned int pxl = sparseFromPXL;
+	} sparseFrom;
+
+	bool sparse(XL const& t, unsigned int prob) const { return prob >= sparseFrom.xl; }
+	bool sparse(AXL const& t, unsigned int prob) const { return prob >= sparseFrom.axl; }
+	bool sparse(PXL const& t, unsigned int prob) const { return prob >= sparseFrom.pxl; }
+
+	//Visit the events of probability 1/prob among length pixels, jumping straight from one to the next
+	template<typename Visit>
+	void forEachEvent(unsigned int prob, std::uint64_t first, std::size_t length, Visit&& visit) const {
+		double miss = std::log1p(-1.0 / prob);
+		std::uint64_t k = 0;
+		for (std::uint64_t j = draws.gap(rng::Purpose::SKIP, first, miss, length); j < length;
+			j += 1 + draws.gap(rng::Purpose::SKIP, first + ++k, miss, length)) {
+			visit((std::size_t)j);
+		}
+	}
+
+	//Whole image command with rare events, only the pixels that get one are visited
+	template<typename TForm>
+	void mapSparse(TForm const& t, unsigned int prob) {
+		//The back buffer only gets the visited pixels
+		constexpr bool neighbours = !std::is_same_v<TForm, XL>;
+		if (neighbours) beginUpdate(true);
+
+		auto rows = [&t, prob, this](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++) {
+				forEachEvent(prob, i * (Width + 1), Width, [&t, i, this](std::size_t j) {
+					apply(i, j, t);
+				});
+			}
+		};
+		if (independent(t)) forEachBand(Height, Width, rows);
+		else rows(0, Height);
+
+		if (neighbours) endUpdate();
+	}
+
+	//Rare events of a box, jumped between like mapSparse. base keys the draws of the box
+	template<typename TForm>
+	void applySparse(TForm const& tform, Rectangle const& box, unsigned int events, std::uint64_t base, bool split) {
+		std::size_t width = box.yM > box.y ? box.yM - box.y : 0;
+		forEachRowIn([&tform, &box, width, events, base, this](std::size_t r, std::size_t x) {
+			forEachEvent(events, base + r * (width + 1), width, [&tform, &box, x, this](std::size_t j) {
+				apply(x, (box.y + j) % Width, tform);
+			});
+		}, box, split && independent(tform));
+	}
+
+	//Dense events of a row span, the mask is drawn for the span into its place in eventMask
+	char const* spanEvents(std::uint64_t base, std::size_t x, std::size_t y, std::size_t length, unsigned int prob) {
+		char* mask = eventMask.data() + x * Width + y;
+		draws.events(rng::Purpose::PIXEL, base + x * Width + y, length, prob, mask);
+		return mask;
+	}
+
+	void applySpan(std::uint64_t base, std::size_t x, std::size_t y, std::size_t length, unsigned int prob, XL const& t) {
+		char const* table = t.translation.table.data();
+		if (prob <= 1) kernels::map(imageBuffer[x] + y, length, table);
+		else kernels::map_masked(imageBuffer[x] + y, spanEvents(base, x, y, length, prob), length, table);
+	}
+
+	template<typename TForm>
+	void applySpan(std::uint64_t base, std::size_t x, std::size_t y, std::size_t length, unsigned int prob, TForm const& t) {
+		char const* events = prob <= 1 ? nullptr : spanEvents(base, x, y, length, prob);
+		for (std::size_t j = 0; j < length; j++) {
+			if (!events || events[j]) apply(x, y + j, t);
+		}
+	}
+
+	//Whole image XL, a plain table lookup so it can be vectorized
+	void mapPixels(XL const& t) {
+		char const* table = t.translation.table.data();
+
+		if (t.prob == 1) {
+			forEachBand(Height, Width, [table, this](std::size_t begin, std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					kernels::map(imageBuffer[i], Width, table);
+				}
+			});
+			return;
+		}
+
+		if (sparse(t, t.prob)) {
+			mapSparse(t, t.prob);
+			return;
+		}
+
+		drawEvents(t.prob);
+		forEachBand(Height, Width, [table, this](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++) {
+				kernels::map_masked(imageBuffer[i], eventMask.data() + i * Width, Width, table);
+			}
+		});
+	}
+
+	/*
+		In place PXL that looks at a pixel later in scan order ( R, E, N, B ) always sees it unchanged,
+		except for the last row looking at the first one when wrapping.
+		So bands of rows can run at once, as long as the row right after every band is copied
+		before any of them start, the last image row runs on its own at the end.
+	*/
+	bool looksAhead(char dir) const {
+		return dir == 'R' || dir == 'E' || dir == 'N' || dir == 'B';
+	}
+
+	void mapAhead(PXL const& t) {
+		bool sameRow = t.dir == 'B';
+		int shift = t.dir == 'N' ? -1 : (t.dir == 'E' || t.dir == 'B') ? 1 : 0;
+		//Rows reading the row below leave the last one for the end, it looks at the new first row
+		std::size_t rows = sameRow ? Height : Height - 1;
+		std::size_t band = bandSize(rows, Width);
+		std::size_t span = Width + 2;
+		if (t.prob != 1) drawEvents(t.prob);
+
+		//Copy the row after every band, halo columns included
+		bandRows.resize(sameRow ? 0 : ((rows + band - 1) / band) * span);
+		for (std::size_t b = 0; b * span < bandRows.size(); b++) {
+			std::size_t next = std::min(rows, (b + 1) * band);
+			char const* source = imageBuffer[next] - 1;
+			std::copy(source, source + span, bandRows.begin() + b * span);
+		}
+
+		auto row = [&t, shift, this](std::size_t i, char const* ahead) {
+			char* pixels = imageBuffer[i];
+			char const* events = t.prob == 1 ? nullptr : eventMask.data() + i * Width;
+			for (std::size_t j = 0; j < Width; j++) {
+				if (events && !events[j]) continue;
+				char value = t.translation(ahead[(std::ptrdiff_t)j + shift], pixels[j]);
+				if (value != pixels[j]) writePixel(i, j, value);
+			}
+		};
+
+		forEachBand(rows, Width, [&row, sameRow, band, span, rows, this](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++) {
+				if (sameRow) row(i, imageBuffer[i]);
+				else if (i + 1 == end && end < rows) row(i, bandRows.data() + (i / band) * span + 1);
+				else row(i, imageBuffer[i + 1]);
+			}
+		});
+
+		if (!sameRow) row(Height - 1, imageBuffer.row((std::ptrdiff_t)Height));
+	}
+
+	//Work out the boxes of a box command, random boxes are all kept since each draws whether it is stamped
+	template<typename TForm>
+	void buildStamps(StampCache& cache, Rectangles const& rect, PatternContainer const* pat) {
+		cache.boxes.clear();
+		cache.spans.clear();
+		cache.order.clear();
+
+		auto add = [&cache, &rect, this](std::size_t r, std::size_t c) {
+			auto [x, y] =
+				std::pair{ rect.x + r * rect.h,
+						   rect.y + c * rect.v };
+
+			StampCache::Box box{ Rectangle{ x - rect.w/2,
+					y - rect.t/2,
+					x + rect.w/2,
+					y + rect.t/2 }, c * rect.r + r, cache.spans.size(), 0 };
+			forEachSpanIn([&cache](std::size_t x, std::size_t y, std::size_t length) {
+				cache.spans.push_back({ x, y, length });
+			}, box.rect);
+			box.count = cache.spans.size() - box.first;
+			cache.boxes.push_back(box);
+		};
+
+		if (pat && std::is_same_v<TForm, XL>) {
+			//Overlapping XL boxes give the same image in any order, so walk the set bits row by row
+			std::size_t rows = std::min(rect.r, pat->rows);
+			std::size_t cols = std::min(rect.c, pat->cols);
+			for (std::size_t r = 0; r < rows; r++)
+			{
+				pat->forEachSet(r, [&add, r, cols](std::size_t c) {
+					if (c < cols) add(r, c);
+				});
+			}
+		}
+		else {
+			//Neighbour boxes see the boxes before them, keep going down the columns
+			for (std::size_t c = 0; c < rect.c; c++)
 			{
-				if (pat.data[r][c]) {
-					auto [ax,ay] = 
-						std::pair{ rect.x + r * rect.h, 
-								   rect.y + c * rect.v };
-					
-					forEachPixelIn([&tform, this](int x, int y, char val) {
-						translation(x, y, tform);
-						}, Rectangle{ ax - rect.w/2,
-							ay - rect.t/2,
-							ax + rect.w/2,
-							ay + rect.t/2 });
+				for (std::size_t r = 0; r < rect.r; r++)
+				{
+					if (!pat || pat->test(r, c)) add(r, c);
+				}
+			}
+		}
+	}
 
+	/*
+		Sort the boxes into levels whose boxes can be stamped at the same time.
+		A box goes a level above every earlier box it touches, so touching boxes keep their order.
+		Neighbour commands read a pixel around their box, for them boxes that close touch too
+	*/
+	void levelStamps(StampCache& cache, bool neighbours) {
+		//Zeroed once, afterwards only the stamped spans are put back
+		if (stampLevels.empty()) stampLevels.assign(Width * Height, 0);
+		std::vector<std::uint32_t> level(cache.boxes.size());
+		std::uint32_t top = 0;
+		std::size_t reach = neighbours ? 1 : 0;
+
+		for (std::size_t b = 0; b < cache.boxes.size(); b++) {
+			StampCache::Box const& box = cache.boxes[b];
+			std::uint32_t l = 1;
+			for (std::size_t k = box.first; k < box.first + box.count; k++) {
+				StampCache::Span const& span = cache.spans[k];
+				std::size_t length = std::min(span.length + 2 * reach, Width);
+				for (std::size_t dr = 0; dr <= 2 * reach; dr++) {
+					std::uint32_t const* row = stampLevels.data() + (span.x + Height + dr - reach) % Height * Width;
+					std::size_t y = (span.y + Width - reach) % Width;
+					for (std::size_t j = 0; j < length; j++) {
+						l = std::max(l, row[y] + 1);
+						if (++y == Width) y = 0;
+					}
 				}
 			}
+			for (std::size_t k = box.first; k < box.first + box.count; k++) {
+				StampCache::Span const& span = cache.spans[k];
+				std::fill_n(stampLevels.data() + span.x * Width + span.y, span.length, l);
+			}
+			level[b] = l;
+			top = std::max(top, l);
 		}
+		for (StampCache::Span const& span : cache.spans) {
+			std::fill_n(stampLevels.data() + span.x * Width + span.y, span.length, 0);
+		}
+
+		//Boxes by level, in stamp order within one
+		cache.levels.assign(top + 2, 0);
+		cache.levelPixels.assign(top + 1, 0);
+		for (std::size_t b = 0; b < cache.boxes.size(); b++) {
+			cache.levels[level[b] + 1]++;
+			StampCache::Box const& box = cache.boxes[b];
+			for (std::size_t k = box.first; k < box.first + box.count; k++) cache.levelPixels[level[b]] += cache.spans[k].length;
+		}
+		for (std::size_t l = 1; l < cache.levels.size(); l++) cache.levels[l] += cache.levels[l - 1];
+		cache.order.resize(cache.boxes.size());
+		std::vector<std::size_t> next(cache.levels.begin(), cache.levels.end() - 1);
+		for (std::size_t b = 0; b < cache.boxes.size(); b++) cache.order[next[level[b]]++] = b;
 	}
 
+	//One box, split says whether its rows may be spread across the threads
+	template<typename TForm>
+	void stampBox(TForm const& tform, StampCache const& cache, StampCache::Box const& box, unsigned int events, bool split) {
+		std::uint64_t base = box.index * Width * Height;
+		if (sparse(tform, events)) {
+			applySparse(tform, box.rect, events, base, split);
+			return;
+		}
+
+		//Big boxes are split across the threads like whole image commands
+		std::size_t height = box.rect.xM - box.rect.x, width = box.rect.yM - box.rect.y;
+		if (split && box.count != 0 && independent(tform) && threads() > 1 && height * width >= 4096) {
+			forEachSpanIn([&tform, base, events, this](std::size_t x, std::size_t y, std::size_t length) {
+				applySpan(base, x, y, length, events, tform);
+			}, box.rect, true);
+			return;
+		}
+
+		for (std::size_t k = box.first; k < box.first + box.count; k++) {
+			StampCache::Span const& span = cache.spans[k];
+			applySpan(base, span.x, span.y, span.length, events, tform);
+		}
+	}
+
+	//Stamp the boxes, with a probability every box is drawn for first
 	template<typename TForm, typename = std::enable_if_t<in_transform_group<TForm>>>
-	void applyBoxes(Rectangles const& rect, int const& prob, TForm const& tform) {
-		for (std::size_t c = 0; c < rect.c; c++)
-		{
-			for (std::size_t r = 0; r < rect.r; r++)
-			{
-				if (hasEventOccured(prob)) {
-					auto [x, y] = 
-						std::pair{ rect.x + r * rect.h,
-								   rect.y + c * rect.v };
-					
-					forEachPixelIn([&tform, this](std::size_t x, std::size_t y, char val) {
-						translation(x, y, tform);
-						}, Rectangle{ x - rect.w/2,
-							y - rect.t/2,
-							x + rect.w/2,
-							y + rect.t/2 });
+	void applyStamps(StampCache& cache, std::optional<int> boxes, TForm const& tform) {
+		//Box k takes the k-th of the draws, so they can be made in any order
+		std::uint64_t first = sequence;
+		if (boxes) sequence += cache.boxes.size();
+		auto stamped = [&boxes, first, this](std::size_t b) {
+			return !boxes || draws.event(rng::Purpose::SEQUENCE, first + b, boxes.value());
+		};
+
+		auto prob = eventProbability(tform);
+		if (!prob) return;
+		unsigned int events = prob.value();
+		if (!sparse(tform, events) && events > 1 && eventMask.size() < Width * Height) eventMask.resize(Width * Height);
+
+		if (threads() == 1 || cache.boxes.size() < 2) {
+			for (std::size_t b = 0; b < cache.boxes.size(); b++) {
+				if (stamped(b)) stampBox(tform, cache, cache.boxes[b], events, true);
+			}
+			return;
+		}
+
+		constexpr bool neighbours = !std::is_same_v<TForm, XL>;
+		if (cache.order.empty()) levelStamps(cache, neighbours);
+
+		for (std::size_t l = 0; l + 1 < cache.levels.size(); l++) {
+			std::size_t begin = cache.levels[l], count = cache.levels[l + 1] - begin;
+			if (count == 0) continue;
+
+			//Levels of a few small boxes are not worth waking the threads for
+			if (count == 1 || cache.levelPixels[l] < 4096) {
+				for (std::size_t i = begin; i < begin + count; i++) {
+					std::size_t b = cache.order[i];
+					if (stamped(b)) stampBox(tform, cache, cache.boxes[b], events, count == 1);
 				}
+				continue;
 			}
+
+			pool->run(count, pool->grain(count), [&cache, &tform, &stamped, begin, events, this](std::size_t from, std::size_t to) {
+				for (std::size_t i = begin + from; i < begin + to; i++) {
+					std::size_t b = cache.order[i];
+					if (stamped(b)) stampBox(tform, cache, cache.boxes[b], events, false);
+				}
+			});
 		}
 	}
 
-	std::variant<int, PatternContainer> resolvePattern(Parameter& p) {
-		if (p.is_variable) {
-			//Get pattern
-			auto res = patterns.find(std::get<std::string>(p.value));
-			if (res != patterns.end()) {
-				return res->second;
+	//A row of the image through tTable into the frame, 8 pixels to a byte
+	void takeRow(std::size_t i, std::uint64_t base) {
+		char const* pixels = imageBuffer[i];
+		std::uint8_t* out = shot.row(i);
+		//Rows without twinkling pixels draw nothing
+		if (kernels::pack(pixels, Width, tTable, out)) return;
+
+		for (std::size_t b = 0; b < shot.stride; b++) {
+			std::size_t first = b * 8;
+			std::size_t count = std::min<std::size_t>(8, Width - first);
+			unsigned int byte = 0;
+			for (std::size_t k = 0; k < count; k++) {
+				char value = tTable[(std::size_t)pixels[first + k]];
+				if (value == 2) {
+					value = draws.uniform(rng::Purpose::TWINKLE, base + i * Width + first + k) <= 0.5;
+				}
+				byte |= (unsigned int)(value != 0) << (7 - k);
 			}
-			else {
+			out[b] = (std::uint8_t)byte;
+		}
+	}
 
+	//The image under the pattern through tTable, a word of 64 pixels at a time
+	void capture(PatternContainer& pat, std::size_t x, std::size_t y) {
+		forEachRowIn([&pat, y, this](std::size_t r, std::size_t row) {
+			char const* pixels = imageBuffer[row] + y;
+			std::uint64_t* bits = pat.row(r);
+			for (std::size_t w = 0; w < pat.stride; w++) {
+				std::size_t first = w * 64;
+				std::size_t count = std::min<std::size_t>(64, pat.cols - first);
+				std::uint64_t word = 0;
+				for (std::size_t b = 0; b < count; b++) {
+					char value = tTable[(std::size_t)pixels[first + b]];
+					if (value == 2) {
+						value = draws.uniform(rng::Purpose::TWINKLE, row * Width + y + first + b) <= 0.5;
+					}
+					word |= (std::uint64_t)(value != 0) << b;
+				}
+				bits[w] = word;
+			}
+		}, Rectangle{ x, y, x + pat.rows, y + pat.cols }, true);
+	}
+
+	//Either the probability of the boxes or the pattern stored in the slot, nothing is copied
+	std::variant<int, PatternContainer const*> resolvePattern(Parameter const& p) const {
+		if (p.is_variable) {
+			auto const& stored = patterns[p.slot];
+			if (!stored) {
 				throw std::exception{ "Unknown pattern name mentioned" };
 			}
+			return &*stored;
 		}
 		return std::get<int>(p.value);
 	}
@@ -295,29 +962,45 @@ public:
 		if (!p.is_valid) return std::nullopt;
 
 		if (p.is_variable) {
-			std::string name = std::get<std::string>(p.value);
-			auto res = variables.find(name);
-			if (res == variables.end()) {
-				//Add initial variable value
-				variables.emplace(std::make_pair(name, 0));
-				return 0;
-			}
-			return res->second;
+			return variables[p.slot];
 		}
 		return std::get<int>(p.value);
 	}
 
 	void setVariable(Parameter& p, int newValue) {
 		//Throw exeption if its a int
-		std::string name = std::get<std::string>(p.value);
-		auto res = variables.find(name);
-		if (res == variables.end()) {
-			variables.emplace(std::make_pair(name, newValue));
+		if (!p.is_variable) {
+			throw std::exception{ "Cannot assign a value to a constant" };
 		}
-		else {
-			res->second = newValue;
+		variables[p.slot] = newValue;
+	}
+
+	//Intern a variable name into a storage slot, constants are left as is
+	void bindVariable(Parameter& p) {
+		if (!p.is_variable) return;
+
+		std::string const& name = std::get<std::string>(p.value);
+		auto res = variableSlots.find(name);
+		if (res == variableSlots.end()) {
+			res = variableSlots.emplace(name, (int)variables.size()).first;
+			//Add initial variable value
+			variables.push_back(0);
+		}
+		p.slot = res->second;
+	}
+
+	//Slot of a pattern name, patterns used before they are defined get an empty slot
+	int patternSlot(std::string const& name) {
+		auto res = patternSlots.find(name);
+		if (res == patternSlots.end()) {
+			res = patternSlots.emplace(name, (int)patterns.size()).first;
+			patterns.emplace_back();
 		}
+		return res->second;
+	}
 
+	void bindPattern(Parameter& p) {
+		if (p.is_variable) p.slot = patternSlot(std::get<std::string>(p.value));
 	}
 
 	void modifyVariable(Parameter& var, CHOp operation, Parameter& from, Parameter& to) {
@@ -327,7 +1010,7 @@ public:
 		int newValue = 0;
 		if (to_) {
 			//Choose a random value in the range
-			newValue = std::trunc(dis(gen) * abs(to_.value() - from_.value())) + from_.value();
+			newValue = std::trunc(nextUniform() * abs(to_.value() - from_.value())) + from_.value();
 		}
 		else {
 			newValue = from_.value();
@@ -369,6 +1052,7 @@ public:
 					   for (char& c : cset)
 						   c = transform.transform(c);
 				}
+				comnd.transform.translation.compile();
 				},
 				[](auto&&) {
 					//Throw error
@@ -437,6 +1121,7 @@ public:
 						}
 					}
 				}
+				comnd.translation.compile();
 			},
 			[&transform,&prob,this](BPXL& comnd) {
 				for (std::array<char,3>& trpl : comnd.transform.translation.translations) {
@@ -446,6 +1131,7 @@ public:
 						}
 					}
 				}
+				comnd.transform.translation.compile();
 			},
 			[](auto&&) {
 				//Throw error
@@ -521,40 +1207,141 @@ public:
 		auto pat = resolvePattern(command.pattern);
 
 		//if i could traverse structures easy this could be nicer
-		std::vector<std::size_t> rect = { 0,0,0,0,0,0,0,0 };
+		std::array<std::size_t, 8> rect = { 0,0,0,0,0,0,0,0 };
 		std::transform(std::cbegin(command.rectangle), std::cend(command.rectangle), std::begin(rect),
-			[this](auto item) { return resolveVariable(item).value();  });
+			[this](Parameter const& item) { return resolveVariable(item).value();  });
+
+		using TForm = decltype(command.transform);
+		prepare(command.transform);
+
+		//The boxes are only worked out again when the pattern or the rectangles changed
+		StampCache& cache = stamps[pc];
+		PatternContainer const* const* stored = std::get_if<PatternContainer const*>(&pat);
+		int slot = stored ? command.pattern.slot : -1;
+		std::uint64_t version = stored ? (*stored)->version : 0;
+		if (!cache.matches(slot, version, rect)) {
+			buildStamps<TForm>(cache, Rectangles(rect), stored ? *stored : nullptr);
+			cache.valid = true;
+			cache.slot = slot;
+			cache.version = version;
+			cache.rect = rect;
+		}
 
-		Rectangles r = rect;
-		
-		//Use the boxes applicator
-		std::visit(overloaded{
-			[&command,&r,this](int& prob) {
-				applyBoxes(r, prob, command.transform);
-			},
-			[&command,&r,this](PatternContainer& pat) {
-				applyPattern(r, pat, command.transform);
-			}
-			}, pat);
+		//Boxes leave most of the image alone, so the back buffer starts as a copy
+		constexpr bool neighbours = !std::is_same_v<TForm, XL>;
+		if (neighbours) beginUpdate(true);
+
+		std::optional<int> boxes;
+		if (!stored) boxes = std::get<int>(pat);
+		applyStamps(cache, boxes, command.transform);
+
+		if (neighbours) endUpdate();
+
+		//Grids far bigger than the image are not worth the memory
+		if (cache.spans.size() > maxStampSpans) {
+			cache = StampCache{};
+		}
 	}
 
 	bool valueToPixel(char c) {
 
 	}
 
+	int resolveLabel(std::string const& label) const {
+		auto labeledLine = namedMap.find(label);
+		if (labeledLine != namedMap.end()) {
+			return labeledLine->second;
+		}
+		return Instruction::none;
+	}
+
+	//Resolve every label into a line index, must be done after all lines are added
+	void compile() {
+		//Lines are only ever appended, so a matching size means nothing changed
+		if (program.size() == commands.size()) return;
+
+		program.clear();
+		program.reserve(commands.size());
+		stamps.assign(commands.size(), StampCache{});
+
+		for (Command& line : commands) {
+			Instruction ins;
+			ins.next = resolveLabel(line.goto_);
+
+			std::visit(overloaded{
+				[this](AXL& command) {
+					bindVariable(command.prob);
+				},
+				[this](BAXL& command) {
+					bindVariable(command.transform.prob);
+					bindPattern(command.pattern);
+					for (Parameter& p : command.rectangle) bindVariable(p);
+				},
+				[this](BXL& command) {
+					bindPattern(command.pattern);
+					for (Parameter& p : command.rectangle) bindVariable(p);
+				},
+				[this](BPXL& command) {
+					bindPattern(command.pattern);
+					for (Parameter& p : command.rectangle) bindVariable(p);
+				},
+				[this](IF& command) {
+					bindVariable(command.lhs);
+					bindVariable(command.rhs);
+				},
+				[this](SVP& command) {
+					bindVariable(command.x);
+					bindVariable(command.y);
+					bindVariable(command.width);
+					bindVariable(command.height);
+					command.slot = patternSlot(command.label);
+				},
+				[this](CHP& command) {
+					command.pattern = command.newLabel;
+					bindPattern(command.pattern);
+				},
+				[this](CHV& command) {
+					bindVariable(command.location);
+					bindVariable(command.value1);
+					bindVariable(command.value2);
+				},
+				[](auto&) {}
+				}, line.cmd);
+
+			std::visit(overloaded{
+				[&ins,this](GOTO const& command) {
+					ins.target = command.label == "DONE" ? Instruction::done : resolveLabel(command.label);
+				},
+				[&ins,this](DO const& command) {
+					ins.target = resolveLabel(command.label);
+				},
+				[&ins,this](CHP const& command) {
+					ins.target = resolveLabel(command.instance);
+				},
+				[&ins,this](XLI const& command) {
+					ins.target = resolveLabel(command.label);
+				},
+				[](auto const&) {}
+				}, line.cmd);
+
+			program.push_back(ins);
+		}
+	}
+
 	void execute() {
-		std::vector<int> stack_counter;
+		compile();
 		//Maybe a more sophisticated aproach to handling the program counter		
 		after_coroutine = -1;
 		
 		while (pc < commands.size()) {
 			nextCounter = -1;
 
-			Probability& prob = commands.at(pc).prob;
-			CommandType& cmd = commands.at(pc).cmd;
-			std::string_view next = commands.at(pc).goto_;
+			Command& line = commands[pc];
+			Instruction const& ins = program[pc];
 			//std::cout << "Executing Line # " << pc << " + " << nextCounter << '\n';
-			if (prob.check(executeCounter[pc])) {
+			draws = rng::Stream(seed, pc, executeCounter[pc]);
+			sequence = 0;
+			if (line.prob.check(executeCounter[pc], draws.bits(rng::Purpose::LINE, 0))) {
 
 				//Execute appropriate code
 				std::visit(overloaded{
@@ -573,42 +1360,42 @@ public:
 						neighbourhood_mode = command.neighbourhood;
 						render_mode = command.render;
 						wrap_mode = command.wrap;
+						update_mode = command.update;
 					},
 					[this](CAM& command) {
 						for (size_t frame = 0; frame < (size_t)command.frames; frame++)
 						{
-							//For each frame create a bitmap
-							auto temp = new ImageBitmap;
-
-							forEachPixel([&temp,this](int x, int y, char value) {
-								char newValue = tTable[pxl_to_index(value)];
-								if (newValue == 2) {
-									newValue = dis(gen) <= 0.5;
-								}
-								
-								(*temp)[x][y] = newValue;
+							std::uint64_t base = frame * Width * Height;
+							shot.reset(Width, Height);
+							forEachBand(Height, Width, [base, this](std::size_t begin, std::size_t end) {
+								for (std::size_t i = begin; i < end; i++) takeRow(i, base);
 							});
-
-							frames.push_back(std::forward<ImageBitmap>(*temp));
-							delete temp;
+							sink->write(shot);
 						}
 					},
 					[this](XL& command) {
-						forEachPixel([&command,this](int x, int y, char value) {
-							translation(x,y,command);
-						});
-
+						mapPixels(command);
 					},
 					[this](AXL& command) {
-						forEachPixel([&command,this](int x, int y, char value) {
-							translation(x,y,command);
-						});
-
+						mapRegion(command);
 					},
 					[this](PXL& command) {
-						forEachPixel([&command,this](int x,int y,char value) {
-							translation(x,y,command);
-						});
+						prepare(command);
+						if (sparse(command, command.prob)) {
+							mapSparse(command, command.prob);
+						}
+						else if (synchronous()) {
+							mapNeighbourSync(command);
+						}
+						else if (looksAhead(command.dir)) {
+							mapAhead(command);
+						}
+						else {
+							if (command.prob != 1) drawEvents(command.prob);
+							forEachPixel([&command,this](int x,int y,char value) {
+								if (command.prob == 1 || eventMask[x * Width + y]) apply(x, y, command);
+							});
+						}
 
 					},
 					[this](BXL& command) {
@@ -620,22 +1407,19 @@ public:
 					[this](BAXL& command) {
 						patternTransform(command);
 					},
-					[this](GOTO& command) {
+					[this,&ins](GOTO& command) {
 						
-						if (command.label == "DONE") {
+						if (ins.target == Instruction::done) {
 							//Special instruction to return to prev point
 							//of execution before starting the DO statement
 							nextCounter = after_coroutine;
 							after_coroutine = -1;
-						}else {
-							auto labeledLine = namedMap.find(command.label);
-							if (labeledLine != namedMap.end()) {
-								nextCounter = labeledLine->second;
-							}
+						}else if (ins.target != Instruction::none) {
+							nextCounter = ins.target;
 						}
 						
 					},
-					[this,&next](IF& command) {
+					[this,&ins](IF& command) {
 						
 						int lhs = resolveVariable(command.lhs).value();
 						int rhs = resolveVariable(command.rhs).value();
@@ -658,22 +1442,18 @@ public:
 						}
 
 						//Transfer execution if test succeds
-						if (comparison) {
-							auto labeledLine = namedMap.find(next.data());
-							if (labeledLine != namedMap.end()) {
-								nextCounter = labeledLine->second;
-							}
+						if (comparison && ins.next != Instruction::none) {
+							nextCounter = ins.next;
 						}
 
 					},
-					[this,&next](DO& command) {
+					[this,&line,&ins](DO& command) {
 						
 						//Set execution counter resume point
-						if (next == "") {
+						if (line.goto_.empty()) {
 							//Execution continues at a certain label
-							auto labeledLine = namedMap.find(next.data());
-							if (labeledLine != namedMap.end()) {
-								after_coroutine = labeledLine->second;
+							if (ins.next != Instruction::none) {
+								after_coroutine = ins.next;
 							}
 						}
 						else {
@@ -682,9 +1462,8 @@ public:
 						}
 
 						//Transfer execution
-						auto labeledLine = namedMap.find(command.label);
-						if (labeledLine != namedMap.end()) {
-							nextCounter = labeledLine->second;
+						if (ins.target != Instruction::none) {
+							nextCounter = ins.target;
 						}
 
 					},
@@ -694,95 +1473,82 @@ public:
 						std::size_t w = resolveVariable(command.width).value();
 						std::size_t h = resolveVariable(command.height).value();
 
-						if (x + w > 340 || y + h > 240) {
+						if (x + w > Height || y + h > Width) {
 							throw std::exception{ "[SVP] Pattern out of bounds." };
 						}
 						else {
-							PatternContainer newPattern(w, h);
-							forEachPixelIn([this, &newPattern, &x, &y, &w, &h](int xC, int yC, char value) {
-								char newValue = tTable[pxl_to_index(value)];
-								if (newValue == 2) {
-									newValue = dis(gen) <= 0.5;
-								}
-								newPattern.data[xC - x][yC - y] = newValue;
-								}, Rectangle{ x, y, x + w, y + h });
-
-							//Push pattern
-							patterns.emplace(std::make_pair(command.label, newPattern));
+							//Captured again under the same label overwrites the pattern in its slot
+							auto& stored = patterns[command.slot];
+							if (!stored) stored.emplace();
+							stored->resize(w, h);
+							stored->version = ++patternEdits;
+							capture(*stored, x, y);
+
 						}
 					},
 					[this](CHV& command) {
 						modifyVariable(command.location, command.operation, command.value1, command.value2);
 					},
-					[this](CHP& command) {
-						auto labeledLine = namedMap.find(command.instance);
-						int cmdIndex = -1;
-						if (labeledLine != namedMap.end()) {
-							cmdIndex = labeledLine->second;
+					[this,&ins](CHP& command) {
+						if (ins.target == Instruction::none) {
+							throw std::exception{ "[CHP] Unknown instance label" };
 						}
-						//Throw if not found
+
 						std::visit(overloaded{
 							[&command](BXL& c) {
-								c.pattern = command.newLabel;
+								c.pattern = command.pattern;
 							},
 							[&command](BAXL& c) {
-								c.pattern = command.newLabel;
+								c.pattern = command.pattern;
 							},
 							[&command](BPXL& c) {
-								c.pattern = command.newLabel;
+								c.pattern = command.pattern;
 							},
 							[](auto&&) {
 								//Throw error
 								throw std::exception{"[CHP] Change Pattern can only be performed on [BXL,BAXL,BPXL]"};
 							}
-							}, commands[cmdIndex].cmd);
+							}, commands[ins.target].cmd);
 
 
 
 					},
-					[this](XLI& command) {
-						auto labeledLine = namedMap.find(command.label);
-						int cmdIndex = -1;
-						if (labeledLine != namedMap.end()) {
-							cmdIndex = labeledLine->second;
+					[this,&ins](XLI& command) {
+						if (ins.target == Instruction::none) {
+							throw std::exception{ "[XLI] Unknown instance label" };
 						}
+						CommandType& target = commands[ins.target].cmd;
 
 						//Throw on wrong command
 						switch (command.location)
 						{
 						case CHLoc::NUMS:
-							transformNUMS(commands[cmdIndex].cmd, command.prob, command.transform);
+							transformNUMS(target, command.prob, command.transform);
 							break;
 						case CHLoc::DIRS:
-							transformDIRS(commands[cmdIndex].cmd, command.prob, command.transform);
+							transformDIRS(target, command.prob, command.transform);
 							break;
 						case CHLoc::CHST:
-							transformCHST(commands[cmdIndex].cmd, command.prob, command.transform);
+							transformCHST(target, command.prob, command.transform);
 							break;
 						case CHLoc::XLIT:
-							transformXLIT(commands[cmdIndex].cmd, command.prob, command.transform);
+							transformXLIT(target, command.prob, command.transform);
 							break;
 						case CHLoc::WBTS:
-							transformWBTS(commands[cmdIndex].cmd, command.prob, command.transform);
+							transformWBTS(target, command.prob, command.transform);
 							break;
 						case CHLoc::TPLS:
-							transformTPLS(commands[cmdIndex].cmd, command.prob, command.transform);
+							transformTPLS(target, command.prob, command.transform);
 							break;
 						default:
 							break;
 						}
 					}
-					}, cmd);
+					}, line.cmd);
 
-				
-				
-					auto labeledLine = namedMap.find(next.data());
-
-					if (labeledLine != namedMap.end()) {
-						nextCounter = labeledLine->second;
-					}
-				
-			
+				if (ins.next != Instruction::none) {
+					nextCounter = ins.next;
+				}
 			}
 			
 			++executeCounter[pc];
@@ -0,0 +1,194 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+#include "ExplorKernels.h"
+
+/*
+	Counter based random numbers ( Philox 4x32-10 ).
+	Every draw is a pure function of the seed, the line, how many times the line ran
+	and the index of the draw ( usually the pixel ), so pixels can draw in any order
+	on any thread and still get the same numbers
+*/
+namespace rng {
+
+	//Separate streams for the different things a line draws
+	enum class Purpose : std::uint32_t {
+		LINE,		//Probability of the line itself
+		PIXEL,		//Per pixel events, indexed by box * width * height + row * width + column
+		TWINKLE,	//Twinkling pixels of CAMERA and SVP, indexed by frame and pixel the same way
+		SEQUENCE,	//Everything drawn one after another ( boxes, CHV, XLI )
+		SKIP		//Gaps between sparse events, indexed by row * row length + event number
+	};
+
+	using Block = std::array<std::uint32_t, 4>;
+
+	constexpr std::uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+	constexpr std::uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+	inline Block philox(Block c, std::uint32_t k0, std::uint32_t k1) {
+		for (int round = 0; round < 10; round++) {
+			std::uint64_t p0 = (std::uint64_t)M0 * c[0];
+			std::uint64_t p1 = (std::uint64_t)M1 * c[2];
+			c = { (std::uint32_t)(p1 >> 32) ^ c[1] ^ k0, (std::uint32_t)p1,
+				  (std::uint32_t)(p0 >> 32) ^ c[3] ^ k1, (std::uint32_t)p0 };
+			k0 += W0;
+			k1 += W1;
+		}
+		return c;
+	}
+
+	//An event of probability 1/prob happens for draws below this
+	inline std::uint64_t threshold(std::uint32_t prob) {
+		const std::uint64_t range = std::uint64_t(1) << 32;
+		return prob <= 1 ? range : (range + prob - 1) / prob;
+	}
+
+	struct Stream;
+
+	//Mask bytes of whole blocks ( 4 draws each ) starting at block first, -1 for an event and 0 otherwise
+	using EventsFunction = void(*)(Stream const& s, Purpose p, std::uint64_t first, std::size_t blocks, std::uint32_t limit, char* mask);
+
+	struct Stream {
+		std::uint32_t k0{ 0 }, k1{ 0 };
+		std::uint32_t line{ 0 }, execution{ 0 };
+
+		Stream() = default;
+		Stream(std::uint64_t seed, std::size_t line, std::size_t execution)
+			:k0((std::uint32_t)seed), k1((std::uint32_t)(seed >> 32)),
+			line((std::uint32_t)line), execution((std::uint32_t)execution) {}
+
+		//The purpose goes in the top byte of the block number
+		Block counter(Purpose p, std::uint64_t block) const {
+			return { (std::uint32_t)block, (std::uint32_t)(block >> 32) | ((std::uint32_t)p << 24), line, execution };
+		}
+
+		Block block(Purpose p, std::uint64_t b) const {
+			return philox(counter(p, b), k0, k1);
+		}
+
+		std::uint32_t bits(Purpose p, std::uint64_t index) const {
+			return block(p, index >> 2)[index & 3];
+		}
+
+		//In [0,1)
+		double uniform(Purpose p, std::uint64_t index) const {
+			return bits(p, index) * (1.0 / 4294967296.0);
+		}
+
+		bool event(Purpose p, std::uint64_t index, std::uint32_t prob) const {
+			return prob <= 1 || bits(p, index) < threshold(prob);
+		}
+
+		//Number of misses before the next event, geometric for miss = log( 1 - 1/prob ), at most limit
+		std::uint64_t gap(Purpose p, std::uint64_t index, double miss, std::uint64_t limit) const {
+			double skip = std::floor(std::log1p(-uniform(p, index)) / miss);
+			return skip < (double)limit ? (std::uint64_t)skip : limit;
+		}
+
+		//mask[k] is -1 when draw first + k is an event of probability 1/prob, 0 otherwise
+		void events(Purpose p, std::uint64_t first, std::size_t count, std::uint32_t prob, char* mask) const;
+	};
+
+	inline void events_scalar(Stream const& s, Purpose p, std::uint64_t first, std::size_t blocks, std::uint32_t limit, char* mask) {
+		for (std::size_t b = 0; b < blocks; b++) {
+			Block r = s.block(p, first + b);
+			for (int w = 0; w < 4; w++) mask[b * 4 + w] = r[w] < limit ? -1 : 0;
+		}
+	}
+
+#ifdef EXPLOR_X86
+
+	//Full 32x32 bit products of every lane, mul_epu32 only multiplies the even ones
+	EXPLOR_TARGET("avx2")
+	inline void mulhilo_avx2(__m256i a, __m256i m, __m256i& hi, __m256i& lo) {
+		__m256i even = _mm256_mul_epu32(a, m);
+		__m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+		hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+		lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+	}
+
+	//8 blocks at once, lane l holds block first + l
+	EXPLOR_TARGET("avx2")
+	inline void events_avx2(Stream const& s, Purpose p, std::uint64_t first, std::size_t blocks, std::uint32_t limit, char* mask) {
+		const __m256i m0 = _mm256_set1_epi32((int)M0), m1 = _mm256_set1_epi32((int)M1);
+		const __m256i sign = _mm256_set1_epi32((int)0x80000000);
+		const __m256i below = _mm256_xor_si256(_mm256_set1_epi32((int)limit), sign);
+		//Bytes come out grouped by word, this puts the 4 words of a block next to each other
+		const __m256i order = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+			0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+		std::size_t b = 0;
+		for (; b + 8 <= blocks; b += 8) {
+			alignas(32) std::uint32_t lo[8], hi[8];
+			for (int l = 0; l < 8; l++) {
+				Block c = s.counter(p, first + b + l);
+				lo[l] = c[0];
+				hi[l] = c[1];
+			}
+			__m256i c0 = _mm256_load_si256((__m256i const*)lo);
+			__m256i c1 = _mm256_load_si256((__m256i const*)hi);
+			__m256i c2 = _mm256_set1_epi32((int)s.line);
+			__m256i c3 = _mm256_set1_epi32((int)s.execution);
+
+			std::uint32_t k0 = s.k0, k1 = s.k1;
+			for (int round = 0; round < 10; round++) {
+				__m256i hi0, lo0, hi1, lo1;
+				mulhilo_avx2(c0, m0, hi0, lo0);
+				mulhilo_avx2(c2, m1, hi1, lo1);
+				c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+				c1 = lo1;
+				c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+				c3 = lo0;
+				k0 += W0;
+				k1 += W1;
+			}
+
+			//Unsigned compare through the sign bit
+			__m256i e0 = _mm256_cmpgt_epi32(below, _mm256_xor_si256(c0, sign));
+			__m256i e1 = _mm256_cmpgt_epi32(below, _mm256_xor_si256(c1, sign));
+			__m256i e2 = _mm256_cmpgt_epi32(below, _mm256_xor_si256(c2, sign));
+			__m256i e3 = _mm256_cmpgt_epi32(below, _mm256_xor_si256(c3, sign));
+			__m256i bytes = _mm256_packs_epi16(_mm256_packs_epi32(e0, e1), _mm256_packs_epi32(e2, e3));
+			_mm256_storeu_si256((__m256i*)(mask + b * 4), _mm256_shuffle_epi8(bytes, order));
+		}
+		events_scalar(s, p, first + b, blocks - b, limit, mask + b * 4);
+	}
+
+#endif
+
+	inline EventsFunction select_events() {
+		switch (kernels::active_isa()) {
+#ifdef EXPLOR_X86
+		case kernels::ISA::AVX2: return events_avx2;
+#endif
+		default: return events_scalar;
+		}
+	}
+
+	inline void Stream::events(Purpose p, std::uint64_t first, std::size_t count, std::uint32_t prob, char* mask) const {
+		if (prob <= 1) {
+			std::memset(mask, -1, count);
+			return;
+		}
+		static const EventsFunction selected = select_events();
+		std::uint32_t limit = (std::uint32_t)threshold(prob);
+
+		//Draws before the first whole block and after the last one, each partial block is made once
+		auto partial = [&](std::size_t k, std::size_t end) {
+			Block r = block(p, (first + k) >> 2);
+			for (; k < end; k++) mask[k] = r[(first + k) & 3] < limit ? -1 : 0;
+		};
+
+		std::size_t k = std::min<std::size_t>(count, (4 - (first & 3)) & 3);
+		if (k != 0) partial(0, k);
+		std::size_t blocks = (count - k) / 4;
+		selected(*this, p, (first + k) >> 2, blocks, limit, mask + k);
+		k += blocks * 4;
+		if (k < count) partial(k, count);
+	}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+	Source file mapped into memory read only, the parser walks it with plain pointers.
+	Nothing is copied, pages come in as the parser reaches them
+*/
+class SourceFile {
+public:
+	SourceFile() = default;
+	SourceFile(SourceFile const&) = delete;
+	SourceFile& operator=(SourceFile const&) = delete;
+
+	~SourceFile() {
+		close();
+	}
+
+	//False when the file can not be opened or mapped, an empty file maps to an empty range
+	bool open(std::filesystem::path const& path) {
+		close();
+#ifdef _WIN32
+		file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx(file, &length)) return false;
+		size = (std::size_t)length.QuadPart;
+		if (size == 0) return true;
+
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) return false;
+		view = (char const*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0) return false;
+
+		struct stat info;
+		if (fstat(file, &info) != 0) return false;
+		size = (std::size_t)info.st_size;
+		if (size == 0) return true;
+
+		void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapped == MAP_FAILED) return false;
+		view = (char const*)mapped;
+		madvise(mapped, size, MADV_SEQUENTIAL);
+#endif
+		return view != nullptr;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (view != nullptr) UnmapViewOfFile(view);
+		if (mapping != nullptr) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (view != nullptr) munmap((void*)view, size);
+		if (file >= 0) ::close(file);
+		file = -1;
+#endif
+		view = nullptr;
+		size = 0;
+	}
+
+	char const* begin() const { return view; }
+	char const* end() const { return view + size; }
+
+private:
+	char const* view{ nullptr };
+	std::size_t size{ 0 };
+#ifdef _WIN32
+	HANDLE file{ INVALID_HANDLE_VALUE };
+	HANDLE mapping{ nullptr };
+#else
+	int file{ -1 };
+#endif
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+	Persistent pool of worker threads for splitting image work into tiles ( row bands ).
+	Every worker owns a queue of tiles and once it runs dry it steals from the back
+	of the other queues, so tiles of uneven cost still keep every thread busy.
+	The thread calling run() works on the tiles as well.
+*/
+class TilePool {
+public:
+	using Task = std::function<void(std::size_t, std::size_t)>;
+
+	explicit TilePool(std::size_t threads)
+		:threads(threads == 0 ? 1 : threads), queues(new Queue[threads == 0 ? 1 : threads]) {
+		for (std::size_t i = 1; i < this->threads; i++) {
+			workers.emplace_back([this, i] { work(i); });
+		}
+	}
+
+	TilePool(TilePool const&) = delete;
+	TilePool& operator=(TilePool const&) = delete;
+
+	~TilePool() {
+		{
+			std::lock_guard<std::mutex> guard(state);
+			stopping = true;
+			++generation;
+		}
+		wake.notify_all();
+		for (std::thread& t : workers) t.join();
+	}
+
+	std::size_t size() const { return threads; }
+
+	//Tile size that gives every thread a few tiles to balance with
+	std::size_t grain(std::size_t count) const {
+		std::size_t g = count / (threads * 4);
+		return g == 0 ? 1 : g;
+	}
+
+	//Run task(begin, end) over [0, count) in tiles of at most grain items, returns once all are done
+	void run(std::size_t count, std::size_t grain, Task const& task) {
+		if (count == 0) return;
+		if (threads == 1 || count <= grain) {
+			task(0, count);
+			return;
+		}
+
+		std::size_t tiles = (count + grain - 1) / grain;
+		{
+			std::lock_guard<std::mutex> guard(state);
+			current = &task;
+			error = nullptr;
+			remaining = tiles;
+		}
+
+		//Neighbouring tiles go to the same worker
+		for (std::size_t t = 0; t < tiles; t++) {
+			Queue& q = queues[t * threads / tiles];
+			std::lock_guard<std::mutex> guard(q.lock);
+			q.tiles.emplace_back(t * grain, std::min(count, (t + 1) * grain));
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(state);
+			++generation;
+		}
+		wake.notify_all();
+
+		drain(0);
+
+		std::unique_lock<std::mutex> lock(state);
+		done.wait(lock, [this] { return remaining == 0; });
+		current = nullptr;
+		if (error) std::rethrow_exception(error);
+	}
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::pair<std::size_t, std::size_t>> tiles;
+	};
+
+	bool take(std::size_t self, std::pair<std::size_t, std::size_t>& tile) {
+		{
+			Queue& own = queues[self];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.tiles.empty()) {
+				tile = own.tiles.front();
+				own.tiles.pop_front();
+				return true;
+			}
+		}
+		for (std::size_t k = 1; k < threads; k++) {
+			Queue& victim = queues[(self + k) % threads];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tiles.empty()) {
+				tile = victim.tiles.back();
+				victim.tiles.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void drain(std::size_t self) {
+		std::pair<std::size_t, std::size_t> tile;
+		while (take(self, tile)) {
+			try {
+				(*current)(tile.first, tile.second);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(state);
+				if (!error) error = std::current_exception();
+			}
+
+			if (remaining.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> guard(state);
+				done.notify_all();
+			}
+		}
+	}
+
+	void work(std::size_t self) {
+		std::size_t seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(state);
+				wake.wait(lock, [this, seen] { return generation != seen; });
+				seen = generation;
+				if (stopping) return;
+			}
+			drain(self);
+		}
+	}
+
+	const std::size_t threads;
+	std::unique_ptr<Queue[]> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex state;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::size_t generation{ 0 };
+	bool stopping{ false };
+
+	Task const* current{ nullptr };
+	std::atomic<std::size_t> remaining{ 0 };
+	std::exception_ptr error;
+};
@@ -13,6 +13,14 @@
 #include <array>
 #include <variant>
 #include <chrono>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "ExplorKernels.h"
 
 enum class WrapMode {
 	WRP,
@@ -29,6 +37,12 @@ enum class NeighbourhoodMode {
 	HEX
 };
 
+//In place ( every pixel sees the ones already changed ) or synchronous ( all read the image as it was )
+enum class UpdateMode {
+	INP,
+	SYN
+};
+
 enum class Compares {
 	EQ,
 	LT,
@@ -56,6 +70,7 @@ struct Parameter {
 	std::variant<std::monostate, int, std::string > value;
 	bool is_variable = false;
 	bool is_valid = false;
+	int slot = -1; //Index into the variable storage, set by EXPLOR::compile()
 	Parameter() :value(std::monostate{}) {};
 	Parameter(std::string v) {
 		if (v[0] >= 'A' && v[0] <= 'Z') {
@@ -71,45 +86,32 @@ struct Parameter {
 
 };
 
+/*
+	(n,p) runs on every n-th execution with probability 1/p, an X before n flips
+	the executions it runs on and an X before p flips the probability to 1 - 1/p.
+	The chance is kept as a threshold for a 32 bit draw so checking is one compare
+*/
 struct Probability {
-	int n, p;
-	bool xn, xp;
-	std::mt19937 gen;
-	std::uniform_real_distribution<> dis;
+	int n;
+	bool xn;
+	std::uint64_t threshold;
 
 	Probability()
-		:n(1), p(1), xn(0), xp(0) {
+		:n(1), xn(0), threshold(std::uint64_t(1) << 32) {
 	};
 
 	Probability(bool xn_, int n_, bool xp_, int p_)
-		:n(n_), p(p_), xn(xn_), xp(xp_) {
+		:n(n_), xn(xn_) {
 
-		auto seed = (unsigned int)std::chrono::high_resolution_clock::now().time_since_epoch().count() ^ std::random_device()();
-		gen = std::mt19937(seed); //Generate seed 
-		dis = std::uniform_real_distribution<double>(0, 1); // Select Distribution
+		double chance = xp_ ? 1.0 - (1.0 / p_) : 1.0 / p_;
+		double range = (double)(std::uint64_t(1) << 32);
+		threshold = chance <= 0 ? 0 : chance >= 1 ? std::uint64_t(1) << 32 : (std::uint64_t)std::ceil(chance * range);
 	}
 
-	bool check(int execution_count) {
-
-		//(n,p)
-		if (!xn && !xp) { 
-			if (execution_count % n == 0) return dis(gen) < 1.0 / p;
-		}
-		//(X,n,p)
-		if (xn && !xp) {
-			if (execution_count % n != 0) return dis(gen) < 1.0 / p;
-		}
-		//(n,X,p)
-		if (!xn && xp) {
-			if (execution_count % n == 0) return (dis(gen) < 1.0 - (1.0 / p));
-		}
-		//(X,n,X,p)
-		if (xn && xp) {
-			if (execution_count % n != 0) return (dis(gen) < 1.0 - (1.0 / p));
-		}
-
-		//How can we reformat to remove this?
-		return false;
+	//draw is uniform 32 bits from the interpreter
+	bool check(int execution_count, std::uint32_t draw) const {
+		bool turn = (execution_count % n == 0) != xn;
+		return turn && draw < threshold;
 	}
 };
 
@@ -123,51 +125,93 @@ std::size_t pxl_to_index(const char c){
 	return 0;
 }
 
+//The image holds pixel indices ( 0-35 ) instead of their characters
+constexpr char index_to_pxl(std::size_t i) {
+	return i < 10 ? char('0' + i) : char('A' + (i - 10));
+}
+
+constexpr std::size_t pxl_count = 36;
+
 struct XLIT {
 	std::variant<std::string, std::vector<std::string>> replacements;
+	//Pixel index to pixel index, rebuilt by compile() whenever replacements change
+	std::array<char, pxl_count> table;
 
-	XLIT() {};
+	XLIT() { compile(); };
 	XLIT(std::string values, bool full) {
-		replacements = values;
-
 		char lastReplacement = values.back();
+		std::size_t given = values.length();
+		replacements = std::move(values);
+
 		//Fill the remaining values with the last known
 		if (full)
-			for (std::size_t i = 0; i < 36 - values.length(); i++) {
+			for (std::size_t i = 0; i < 36 - given; i++) {
 				std::get<0>(replacements).push_back(lastReplacement);
 			}
+		compile();
 	};
 	XLIT(std::vector < std::string > pairs)
-		:replacements(pairs) {};
+		:replacements(std::move(pairs)) {
+		compile();
+	};
+
+	void compile() {
+		for (std::size_t i = 0; i < pxl_count; i++) {
+			table[i] = (char)i;
+		}
 
-	char transform(char value) const {
 		//Transform with string
 		if (replacements.index() == 0) {
-			if(std::get<0>(replacements).size() <= pxl_to_index(value))
-				return value;
-			return std::get<0>(replacements).at(pxl_to_index(value));
-		}
-		//Transform With Vectors
-		for (auto s : std::get<1>(replacements)) {
-			if (s[0] == value) {
-				return s[1];
+			std::string const& values = std::get<0>(replacements);
+			for (std::size_t i = 0; i < values.size() && i < pxl_count; i++) {
+				table[i] = (char)pxl_to_index(values[i]);
 			}
+			return;
+		}
+		//Transform With Vectors, the first pair for a value wins
+		auto const& pairs = std::get<1>(replacements);
+		for (auto s = pairs.rbegin(); s != pairs.rend(); ++s) {
+			table[pxl_to_index((*s)[0])] = (char)pxl_to_index((*s)[1]);
 		}
-		//No Transformation Occurs
-		return value;
+	}
+
+	//Translate a pixel index
+	char operator[](char index) const {
+		return table[(std::size_t)index];
+	}
+
+	char transform(char value) const {
+		return index_to_pxl(table[pxl_to_index(value)]);
 	}
 };
 
 struct PXLIT {
 	std::vector<std::array<char, 3>> translations;
+	//Indexed by current * ( pxl_count + 1 ) + atDir, rebuilt by compile()
+	//The extra column is for neighbours outside of the image and never translates
+	//Kept on the heap, inline it would make every Command over a kilobyte
+	std::vector<char> table;
+
+	PXLIT() { compile(); };
+	PXLIT(std::vector<std::array<char, 3>> t)
+		:translations(std::move(t)) {
+		compile();
+	};
 
-	char transform(char atDir, char current) const {
-		for (auto t : translations) {
-			if (t[0] == current && t[1] == atDir) {
-				return t[2];
-			}
+	void compile() {
+		table.resize(pxl_count * (pxl_count + 1));
+		for (std::size_t current = 0; current < pxl_count; current++) {
+			std::fill_n(table.begin() + current * (pxl_count + 1), pxl_count + 1, (char)current);
+		}
+		//The first triplet for a pair wins
+		for (auto t = translations.rbegin(); t != translations.rend(); ++t) {
+			table[pxl_to_index((*t)[0]) * (pxl_count + 1) + pxl_to_index((*t)[1])] = (char)pxl_to_index((*t)[2]);
 		}
-		return current;
+	}
+
+	//Translate pixel indices
+	char operator()(char atDir, char current) const {
+		return table[(std::size_t)current * (pxl_count + 1) + (std::size_t)atDir];
 	}
 };
 
@@ -181,6 +225,7 @@ struct MODE {
 	WrapMode wrap;
 	RenderMode render;
 	NeighbourhoodMode neighbourhood;
+	UpdateMode update;
 };
 
 struct CAM {
@@ -246,11 +291,13 @@ struct SVP {
 	Parameter y;
 	Parameter width;
 	Parameter height;
+	int slot = -1; //Pattern slot of the label, set by EXPLOR::compile()
 };
 
 struct CHP {
 	std::string instance; // the label of BXL,BAXL,BPXL 
 	std::string newLabel;
+	Parameter pattern; //newLabel bound to a pattern slot by EXPLOR::compile()
 };
 
 struct CHV {
@@ -267,6 +314,94 @@ struct XLI {
 	XLIT transform;
 };
 
+/*
+	Image pixels with dimensions chosen at runtime, every row starts on a cache line.
+	The image is surrounded by a one pixel halo ( rows -1 and height, columns -1 and width )
+	so neighbours can be read with plain pointer offsets, it holds either a copy of the
+	opposite edges ( wrapping ) or a value that matches no pixel ( plain )
+*/
+struct Canvas {
+	static constexpr std::size_t alignment = 64;
+	static constexpr char outside = (char)pxl_count;
+
+	std::size_t width{ 0 };
+	std::size_t height{ 0 };
+	std::size_t stride{ 0 };
+
+	Canvas() = default;
+	Canvas(std::size_t w, std::size_t h)
+		:width(w), height(h), stride((alignment + w + 1 + alignment - 1) / alignment * alignment),
+		pixels(static_cast<char*>(::operator new[](stride * (h + 2), std::align_val_t(alignment)))) {
+		std::fill_n(pixels.get(), stride * (h + 2), outside);
+		fill(0);
+	}
+
+	//Column 0 of a row, columns -1 and width are the halo
+	char* operator[](std::size_t row) { return origin() + row * stride; }
+	char const* operator[](std::size_t row) const { return origin() + row * stride; }
+
+	//Halo rows are -1 and height
+	char* row(std::ptrdiff_t r) { return origin() + r * (std::ptrdiff_t)stride; }
+
+	//Copy pixels and halo from a canvas of the same size
+	void copyFrom(Canvas const& other) {
+		std::copy_n(other.pixels.get(), stride * (height + 2), pixels.get());
+	}
+
+	void fill(char value) {
+		for (std::size_t i = 0; i < height; i++) {
+			std::fill_n((*this)[i], width, value);
+		}
+	}
+
+	//Copy the opposite edges into the halo
+	void wrapHalo() {
+		for (std::size_t i = 0; i < height; i++) {
+			char* r = (*this)[i];
+			r[-1] = r[width - 1];
+			r[width] = r[0];
+		}
+		std::copy_n(row(height - 1) - 1, width + 2, row(-1) - 1);
+		std::copy_n(row(0) - 1, width + 2, row(height) - 1);
+	}
+
+	void clearHalo() {
+		std::fill_n(row(-1) - 1, width + 2, outside);
+		std::fill_n(row(height) - 1, width + 2, outside);
+		for (std::size_t i = 0; i < height; i++) {
+			(*this)[i][-1] = outside;
+			(*this)[i][width] = outside;
+		}
+	}
+
+	//Keep a wrapped halo up to date after the pixel at row,col was written
+	void mirror(std::size_t r, std::size_t c) {
+		bool top = r == 0, bottom = r == height - 1;
+		bool first = c == 0, last = c == width - 1;
+		if (!(top || bottom || first || last)) return;
+
+		char value = (*this)[r][c];
+		std::ptrdiff_t rows[3] = { (std::ptrdiff_t)r, top ? (std::ptrdiff_t)height : -2, bottom ? -1 : -2 };
+		std::ptrdiff_t cols[3] = { (std::ptrdiff_t)c, first ? (std::ptrdiff_t)width : -2, last ? -1 : -2 };
+		for (std::ptrdiff_t hr : rows) {
+			if (hr == -2) continue;
+			for (std::ptrdiff_t hc : cols) {
+				if (hc != -2) row(hr)[hc] = value;
+			}
+		}
+	}
+
+private:
+	struct AlignedDelete {
+		void operator()(char* p) const { ::operator delete[](p, std::align_val_t(alignment)); }
+	};
+
+	std::unique_ptr<char[], AlignedDelete> pixels;
+
+	char* origin() { return pixels.get() + stride + alignment; }
+	char const* origin() const { return pixels.get() + stride + alignment; }
+};
+
 struct Rectangle {
 	std::size_t x;
 	std::size_t y;
@@ -279,7 +414,7 @@ struct Rectangles {
 	std::size_t w, t;
 	std::size_t h, v;
 	std::size_t c, r;
-	Rectangles(std::vector<std::size_t> const& v)
+	Rectangles(std::array<std::size_t, 8> const& v)
 		:x(v[0]), y(v[1]),
 		w(v[2]), t(v[3]),
 		h(v[4]), v(v[5]),
@@ -297,22 +432,124 @@ struct Command {
 	std::string goto_;
 };
 
-using Pattern = std::vector<bool>;
+//Resolved form of a Command produced by EXPLOR::compile()
+//Labels are replaced by line indices so execution needs no lookups
+struct Instruction {
+	static constexpr int none = -1; //Label missing or unknown
+	static constexpr int done = -2; //GOTO DONE, return from a DO
+
+	int next{ none };   //Line to continue at after a successful execution
+	int target{ none }; //Line referenced by GOTO,DO,CHP,XLI
+};
+
+/*
+	Boxes of a BXL,BAXL,BPXL line in the order they get stamped, cut into row spans.
+	Kept while the pattern and the resolved rectangles stay the same
+*/
+struct StampCache {
+	struct Box {
+		Rectangle rect;
+		std::uint64_t index; //Position in the grid of boxes, keys the pixel draws
+		std::size_t first;   //Spans of the box
+		std::size_t count;
+	};
+
+	struct Span {
+		std::size_t x;
+		std::size_t y;
+		std::size_t length;
+	};
+
+	bool valid{ false };
+	int slot{ -1 }; //Pattern slot, -1 for random boxes
+	std::uint64_t version{ 0 };
+	std::array<std::size_t, 8> rect{};
+
+	std::vector<Box> boxes;
+	std::vector<Span> spans;
+
+	//Boxes grouped into levels that do not touch, filled in once the boxes run on several threads.
+	//order[levels[l]] up to order[levels[l + 1]] are the boxes of level l
+	std::vector<std::size_t> order;
+	std::vector<std::size_t> levels;
+	std::vector<std::size_t> levelPixels;
+
+	bool matches(int s, std::uint64_t v, std::array<std::size_t, 8> const& r) const {
+		return valid && slot == s && version == v && rect == r;
+	}
+};
+
+//One row of a PAT, bit c is bit c % 64 of words[c / 64]
+struct Pattern {
+	std::vector<std::uint64_t> words;
+	std::size_t size{ 0 };
+};
 using Commands = std::variant<Pattern, Command>;
 
+/*
+	Bit packed pattern in one buffer, row r starts stride words into it.
+	Rows are padded to whole words so they can be written from different threads
+*/
 struct PatternContainer {
-	std::vector<Pattern> data;
+	std::vector<std::uint64_t> words;
 	std::size_t rows{ 0 };
 	std::size_t cols{ 0 };
+	std::size_t stride{ 0 };
+	std::uint64_t version{ 0 }; //Set by EXPLOR on every change, so stamp caches see it
 
 	PatternContainer() = default;
-	PatternContainer(std::size_t r, std::size_t c) :rows(r), cols(c) {
-		for (size_t i = 0; i < r; i++)
-		{
-			Pattern col;
-			col.resize(c);
-			data.emplace_back(std::move(col));
+	PatternContainer(std::size_t r, std::size_t c) {
+		resize(r, c);
+	}
+
+	//Reshape to an empty pattern keeping the storage already allocated
+	void resize(std::size_t r, std::size_t c) {
+		rows = r;
+		cols = c;
+		stride = (c + 63) / 64;
+		words.assign(r * stride, 0);
+	}
+
+	std::uint64_t* row(std::size_t r) { return words.data() + r * stride; }
+	std::uint64_t const* row(std::size_t r) const { return words.data() + r * stride; }
+
+	//Bits outside of the pattern are unset
+	bool test(std::size_t r, std::size_t c) const {
+		return r < rows && c < cols && kernels::test_bit(row(r), c);
+	}
+
+	void set(std::size_t r, std::size_t c, bool value) {
+		std::uint64_t mask = std::uint64_t(1) << (c & 63);
+		if (value) row(r)[c >> 6] |= mask;
+		else row(r)[c >> 6] &= ~mask;
+	}
+
+	//Add a row at the bottom, the pattern widens to its longest row
+	void append(Pattern const& p) {
+		if (p.size > cols) widen(p.size);
+		words.resize(words.size() + stride, 0);
+		std::copy(p.words.begin(), p.words.end(), row(rows));
+		rows++;
+	}
+
+	//visit(c) for every set column of row r
+	template<typename Visit>
+	void forEachSet(std::size_t r, Visit&& visit) const {
+		kernels::for_each_set_bit(row(r), cols, std::forward<Visit>(visit));
+	}
+
+private:
+	void widen(std::size_t c) {
+		std::size_t newStride = (c + 63) / 64;
+		if (newStride != stride) {
+			std::vector<std::uint64_t> wider(rows * newStride, 0);
+			for (std::size_t r = 0; r < rows; r++) {
+				std::copy(row(r), row(r) + stride, wider.data() + r * newStride);
+			}
+			words = std::move(wider);
+			stride = newStride;
 		}
+		cols = c;
 	}
 };
 
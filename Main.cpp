@@ -11,39 +11,146 @@
 #include <iterator>
 #include <string>
 #include <filesystem>
+#include <optional>
+#include <memory>
+#include <limits>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #include "ExplorTypes.h"
 #include "parsing/ExplorParser.h"
 #include "ExplorLang.h"
+#include "ExplorSource.h"
 
 
 namespace fs = std::filesystem;
 
+//Whole number up to max, digits only, std::stoul alone would take "-1" and wrap it around
+static std::optional<std::uint64_t> parseNumber(std::string const& text, std::uint64_t max) {
+	if (text.empty()) return std::nullopt;
+	std::uint64_t value = 0;
+	for (char c : text) {
+		if (c < '0' || c > '9') return std::nullopt;
+		std::uint64_t digit = c - '0';
+		if (value > (max - digit) / 10) return std::nullopt;
+		value = value * 10 + digit;
+	}
+	return value;
+}
+
+//Whole number from 1 up to max, 0 when it is not one
+static std::size_t parseCount(std::string const& text, std::size_t max) {
+	return (std::size_t)parseNumber(text, max).value_or(0);
+}
+
 int main(int argc, char** argv) {
-	
-	std::ifstream example;
 
 	if(argc == 1){
 		std::cout << "Input file missing";
 		exit(0);
 	}
 
+	//Optional image size, --size <width>x<height>
+	//number of worker threads, --threads <count>
+	//and seed of the random numbers, --seed <number>
+	//every frame into numbered files, --sequence
+	//or into one stream of images, --stream <path> ( - for the standard output )
+	//number of threads writing them, --writers <count>
+	//and how long every side of the writing took, --timings
+	std::size_t width = 320, height = 240;
+	std::size_t threads = 0;
+	std::optional<std::uint64_t> seed;
+	bool sequence = false;
+	std::optional<std::string> stream;
+	std::size_t writers = 1;
+	bool writersGiven = false;
+	bool timings = false;
+	for (int i = 2; i < argc; i++) {
+		std::string option = argv[i];
+		if (option == "--size" && i + 1 < argc) {
+			std::string size = argv[++i];
+			auto separator = size.find('x');
+			if (separator != std::string::npos) {
+				width = parseCount(size.substr(0, separator), EXPLOR::maxSide);
+				height = parseCount(size.substr(separator + 1), EXPLOR::maxSide);
+			}
+			if (separator == std::string::npos || width == 0 || height == 0) {
+				std::cout << "Invalid image size, expected <width>x<height> of at most " << EXPLOR::maxSide << " each";
+				exit(0);
+			}
+		}
+		else if (option == "--threads" && i + 1 < argc) {
+			threads = parseCount(argv[++i], EXPLOR::maxThreads);
+			if (threads == 0) {
+				std::cout << "Invalid thread count, expected a positive number of at most " << EXPLOR::maxThreads;
+				exit(0);
+			}
+		}
+		else if (option == "--seed" && i + 1 < argc) {
+			seed = parseNumber(argv[++i], std::numeric_limits<std::uint64_t>::max());
+			if (!seed) {
+				std::cout << "Invalid seed, expected a number";
+				exit(0);
+			}
+		}
+		else if (option == "--sequence") {
+			sequence = true;
+		}
+		else if (option == "--stream" && i + 1 < argc) {
+			stream = argv[++i];
+		}
+		else if (option == "--writers" && i + 1 < argc) {
+			writers = parseCount(argv[++i], PBMWriter::maxWriters);
+			writersGiven = true;
+			if (writers == 0) {
+				std::cout << "Invalid writer count, expected a positive number of at most " << PBMWriter::maxWriters;
+				exit(0);
+			}
+		}
+		else if (option == "--timings") {
+			timings = true;
+		}
+		else {
+			std::cout << "Unknown option " << option;
+			exit(0);
+		}
+	}
+
+	if (sequence && stream) {
+		std::cout << "Only one of --sequence and --stream can be given";
+		exit(0);
+	}
+	if (!sequence && !stream && (writersGiven || timings)) {
+		std::cout << "--writers and --timings need --sequence or --stream";
+		exit(0);
+	}
+
+	//Images streamed to the standard output leave the messages to the error output
+	bool toStdout = stream && stream.value() == "-";
+	std::ostream& log = toStdout ? std::cerr : std::cout;
+
 	//Check if file exists
 	auto path = fs::path(argv[1]);
 	if (!fs::exists(path)) {
-		std::cout << "Invalid path specified or File does not exist";
+		log << "Invalid path specified or File does not exist";
 		exit(0);
 	}
 
-	
-	example.open(path.filename(), std::ifstream::in);
+	//The whole source is mapped and parsed in place
+	SourceFile source;
+	if (!source.open(path)) {
+		log << "Could not read " << path.generic_string();
+		exit(0);
+	}
 
-	using ctxFileIter = ContextAwareIterator<std::istreambuf_iterator<char>,16,GenericContext<std::string>>;
+	using ctxFileIter = ContextAwareIterator<char const*,16,GenericContext<std::string>>;
 
-	
-	std::istreambuf_iterator<char> eof;
-	ctxFileIter s = std::istreambuf_iterator<char>(example);
-	ctxFileIter e = eof;
+	GenericContext<std::string> context;
+	ctxFileIter s(source.begin(), context);
+	ctxFileIter e(source.end());
 	
 	 auto result = new decltype(pattern)::return_type;
 
@@ -52,56 +159,101 @@ int main(int argc, char** argv) {
 	bool hasParsed = pattern(s, e, result);
 	
 	if (s != e) {
-		std::cout << "Failed to parse file";
-		std::cout << "Ended @ " << s.line() << '#' << s.column() << '\n';
-		std::cout << "Read " << result->size() << " Lines" << std::endl;
+		log << "Failed to parse file";
+		log << "Ended @ " << s.line() << '#' << s.column() << '\n';
+		log << "Read " << result->size() << " Lines" << std::endl;
 		exit(1);
 	}
 	if (hasParsed) {
 		
 
-		auto program = new EXPLOR<320,240>;
+		auto program = new EXPLOR(width, height, threads);
+		if (seed) program->setSeed(seed.value());
+
+		//Frames are written in the background as they are taken, without an option only the first one is kept
+		auto out_stem = std::string("./").append(path.stem().generic_string());
+		FirstFrame first;
+		std::ofstream stream_file;
+		std::unique_ptr<PBMWriter> writer;
+
+		if (sequence) {
+			writer = std::make_unique<PBMWriter>(sequenceFiles(out_stem), writers);
+		}
+		else if (toStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			writer = std::make_unique<PBMWriter>(streamTo(std::cout), writers);
+		}
+		else if (stream) {
+			stream_file.open(stream.value(), std::ofstream::out | std::ofstream::binary);
+			if (!stream_file) {
+				log << "Could not open " << stream.value();
+				exit(1);
+			}
+			writer = std::make_unique<PBMWriter>(streamTo(stream_file), writers);
+		}
+
+		if (writer) program->setFrameSink(writer.get());
+		else program->setFrameSink(&first);
 
 		for(auto & line: *result) {
-			std::apply([&program](std::string label,Commands command) {
-				program->addLine(label, command);
+			std::apply([&program](std::string& label,Commands& command) {
+				program->addLine(std::move(label), std::move(command));
 			}, line);
 		}
+		delete result;
 		try {
 			program->execute();
 		}
 		catch (std::exception & e) {
 			//Print Error
-			std::cout << "\nEncountered Error -> " << e.what();
+			log << "\nEncountered Error -> " << e.what();
 		}
-		
-		
-		std::ofstream example_out;
-		auto out_path = std::string("./");
-		out_path.append(path.stem().generic_string().append(".pbm"));
-
-		std::cout << "Output 1 Frame to: " << out_path;
-		if (program->frames.size() != 0) {
-			example_out.open(out_path, std::ofstream::out);
 
-			auto& fframe = program->frames[0];
-			example_out << "P1 320 240 1\n";
+		if (writer) {
+			//Whatever is still queued gets written first
+			try {
+				writer->finish();
+			}
+			catch (std::exception & e) {
+				log << "\nEncountered Error -> " << e.what();
+			}
 
-			for (size_t i = 0; i < fframe.size(); i++)
-			{
-				for (size_t j = 0; j < fframe[i].size(); j++)
-				{
-					example_out << fframe.at(i).at(j) << " ";
+			if (sequence) {
+				log << "Output " << writer->frames() << " Frames to: " << sequenceName(out_stem, 0) << " ...";
+			}
+			else {
+				std::cout.flush();
+				log << "Output " << writer->frames() << " Frames to: " << stream.value();
+			}
 
-				}
+			if (timings) {
+				//Render well above write means the writers keep up, wait well above zero means they do not
+				FrameTimings t = writer->timings();
+				auto report = [&log](char const* name, FrameTimings::Stage const& stage, std::size_t frames) {
+					double average = frames == 0 ? 0 : stage.total / frames;
+					log << '\n' << name << ": " << stage.total * 1000 << " ms total, "
+						<< average * 1000 << " ms per frame, " << stage.longest * 1000 << " ms at most";
+				};
+				report("Render", t.render, t.enqueued);
+				report("Enqueue wait", t.wait, t.enqueued);
+				report("Encode", t.encode, t.frames);
+				report("Write", t.write, t.frames);
 			}
-			example_out.close();
+		}
+		else if (first.taken) {
+			auto out_path = out_stem + ".pbm";
+			log << "Output 1 Frame to: " << out_path;
+
+			std::vector<char> encoded;
+			encodePBM(first.frame, encoded);
+			std::ofstream example_out(out_path, std::ofstream::out | std::ofstream::binary);
+			example_out.write(encoded.data(), encoded.size());
 		}
 		else {
-			std::cout << "No frames generated\n";
+			log << "No frames generated\n";
 		}
 	} 
 
-	example.close();
-
 };
\ No newline at end of file
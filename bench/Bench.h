@@ -0,0 +1,57 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <cstdlib>
+
+#include "../ExplorTypes.h"
+#include "../parsing/ExplorParser.h"
+
+/*
+	What the benchmarks and tests share, parsing source text the way Main does and timing.
+	Timings are the best of a few runs rather than their average, a busy machine only adds to them
+*/
+namespace bench {
+
+	using ctxFileIter = ContextAwareIterator<char const*, 16, GenericContext<std::string>>;
+
+	//The whole text through parser into result, false when it stops before the end
+	template<typename Parser>
+	bool parse(Parser const& parser, std::string const& text, typename Parser::return_type& result) {
+		GenericContext<std::string> context;
+		ctxFileIter s(text.data(), context);
+		ctxFileIter e(text.data() + text.size());
+		return parser(s, e, &result) && s == e;
+	}
+
+	//Lines of a program the benchmark cannot go on without
+	inline decltype(pattern)::return_type parseSource(std::string const& text) {
+		decltype(pattern)::return_type result;
+		if (!parse(pattern, text, result)) {
+			std::cout << "Failed to parse " << text;
+			exit(1);
+		}
+		return result;
+	}
+
+	/*
+		Shortest of runs calls of run( index, timed ), in seconds.
+		run does its own setup and passes the part to measure to timed
+	*/
+	template<typename Run>
+	double bestOf(int runs, Run&& run) {
+		double best = std::numeric_limits<double>::max();
+		for (int r = 0; r < runs; r++) {
+			double took = 0;
+			run(r, [&took](auto&& part) {
+				auto start = std::chrono::steady_clock::now();
+				part();
+				took = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			});
+			best = std::min(best, took);
+		}
+		return best;
+	}
+}
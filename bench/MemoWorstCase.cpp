@@ -0,0 +1,59 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+
+#include "Bench.h"
+
+/*
+	Parses lines of every xlit form with and without the memo tables.
+	The plain list form is the worst case, without memoization its list is read twice.
+	Without a MemoScope around the line Memo simply runs its parser
+*/
+
+constexpr auto unmemoized = Repeat(Seq(Optional(line_label), opcodes) >> nl);
+
+constexpr std::size_t lines = 20000;
+constexpr int runs = 15;
+
+//Nanoseconds a line takes
+template<typename Parser>
+double timeLines(Parser const& parser, std::string const& text) {
+	double best = bench::bestOf(runs, [&parser, &text](int, auto timed) {
+		typename Parser::return_type result;
+		result.reserve(lines);
+		bool parsed = false;
+		timed([&] { parsed = bench::parse(parser, text, result); });
+		if (!parsed) {
+			std::cout << "Failed to parse\n";
+			exit(1);
+		}
+	});
+	return best * 1e9 / lines;
+}
+
+int main() {
+	std::string values = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ", longValues;
+	for (int i = 0; i < 10; i++) longValues += values;
+
+	std::vector<std::string> samples = {
+		"\tXL (1,1)3(01,10,AB,BA,C0)\n",
+		"\tXL (1,1)1(" + values + "...)\n",
+		"\tXL (1,1)1(" + values + ")\n",
+		"\tXL (1,1)1(" + longValues + ")\n",
+		"\tAXL (1,1)1234,ABRL,01,1(" + longValues + ")\n",
+	};
+
+	std::cout << "ns per line    memoized  unmemoized\n";
+	std::cout << std::fixed << std::setprecision(0);
+	for (auto const& sample : samples) {
+		std::string text;
+		for (std::size_t i = 0; i < lines; i++) text += sample;
+
+		std::string shown = sample.substr(sample.find_first_not_of('\t'));
+		shown.pop_back();
+		if (shown.size() > 40) shown = shown.substr(0, 30) + "... ( " + std::to_string(shown.size()) + " chars )";
+		std::cout << shown << '\n';
+		std::cout << std::setw(24) << timeLines(pattern, text) << std::setw(12) << timeLines(unmemoized, text) << '\n';
+	}
+}
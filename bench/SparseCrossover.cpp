@@ -0,0 +1,66 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <limits>
+
+#include "Bench.h"
+#include "../ExplorLang.h"
+
+/*
+	Times the whole image XL, AXL and PXL with every event drawn ( dense ) and with the
+	events found by jumping ( sparse ) over a range of probabilities, on one thread.
+	The probability where sparse starts to win is where EXPLOR::sparseFromXL and the others belong
+*/
+
+constexpr std::size_t width = 1920, height = 1080;
+constexpr int linesPerRun = 8;
+constexpr int runs = 5;
+
+//Milliseconds a command takes
+double timeCommand(std::string const& line, EXPLOR::SparseFrom from) {
+	std::string text;
+	for (int i = 0; i < linesPerRun; i++) text += line;
+
+	double best = bench::bestOf(runs, [&text, from](int run, auto timed) {
+		EXPLOR program(width, height, 1);
+		program.setSeed(12345);
+		program.sparseFrom = from;
+		std::mt19937 fill(run);
+		for (std::size_t i = 0; i < height; i++)
+			for (std::size_t j = 0; j < width; j++)
+				program.imageBuffer[i][j] = (char)(fill() % 4);
+
+		for (auto& l : bench::parseSource(text)) {
+			std::apply([&program](std::string& label, Commands& command) {
+				program.addLine(std::move(label), std::move(command));
+			}, l);
+		}
+
+		timed([&program] { program.execute(); });
+	});
+	return best * 1000 / linesPerRun;
+}
+
+int main() {
+	EXPLOR::SparseFrom dense{ std::numeric_limits<unsigned int>::max(), std::numeric_limits<unsigned int>::max(), std::numeric_limits<unsigned int>::max() };
+	EXPLOR::SparseFrom sparse{ 2, 2, 2 };
+
+	std::cout << "ms per command at " << width << 'x' << height << ", one thread\n";
+	std::cout << "prob    XL dense   XL sparse   AXL dense  AXL sparse   PXL dense  PXL sparse\n";
+	std::cout << std::fixed << std::setprecision(2);
+	for (int prob : { 2, 4, 6, 8, 10, 12, 16, 24, 32, 40, 48, 64, 96, 128, 256, 1000 }) {
+		std::string p = std::to_string(prob);
+		std::vector<std::string> lines = {
+			"\tXL (1,1)" + p + "(01,12,23,30)\n",
+			"\tAXL (1,1)123,WANREBSL,1," + p + "(01,12,23,30)\n",
+			"\tPXL (1,1)A," + p + "(012,123,230)\n",
+		};
+		std::cout << std::setw(4) << prob;
+		for (auto const& line : lines) {
+			std::cout << std::setw(12) << timeCommand(line, dense) << std::setw(12) << timeCommand(line, sparse);
+		}
+		std::cout << std::endl;
+	}
+}
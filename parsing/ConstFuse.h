@@ -5,6 +5,9 @@
 #include <variant>
 #include <optional>
 #include <any>
+#include <string>
+#include <string_view>
+#include <cstdint>
 
 namespace constfuse {
 	
@@ -178,38 +181,6 @@ namespace constfuse {
 
 		};
 
-		/*
-			Helper for the Any parser combinator
-		*/
-		template<typename Iterator, typename PResults, typename FResult, typename ...Parsers>
-		inline auto any_parser_applicator(Parsers const& ...p) {
-
-			return [&](Iterator& it, Iterator end, Iterator backtrack, PResults& result, FResult& fres) -> bool {
-				auto aplicator = [&](auto& ...result_item) -> bool {
-					//Pack and pluck after ?
-					Iterator max = backtrack;
-					bool parse_successful = false;
-					bool any_parse = (
-						(backtrack = it,
-							parse_successful = p(backtrack, end, &result_item),
-							max = backtrack < max ? max : backtrack,
-							fres = result_item,
-							parse_successful)
-						|| ...);
-					if (any_parse) {
-						it = backtrack; //maybe
-					}
-					else {
-						it = max; //Max failiure point
-					}
-
-					return any_parse;
-
-				};
-				return std::apply(aplicator, result);
-			};
-		};
-
 	}
 
 	template<typename Parser>
@@ -561,7 +532,7 @@ namespace constfuse {
 			bool res = std::apply(helpers::all_applicator_res<Iterator, return_type, Parsers...>, parsers)(it, end, tmp);
 
 			if (res) {
-				*result = tmp;
+				*result = std::move(tmp);
 			}
 			return res;
 		}
@@ -672,7 +643,7 @@ namespace constfuse {
 			temp_result_type tmpres;
 
 			while (p(it, end, &tmpres)) {
-				result->push_back(tmpres);
+				result->push_back(std::move(tmpres));
 				tmpres = temp_result_type();
 				backtrack = it;
 				++cnt;
@@ -774,26 +745,160 @@ namespace constfuse {
 
 		template<typename Iterator>
 		bool operator()(Iterator& it, Iterator end, return_type* result) const {
-			Iterator backtrack = it;
-			return_type final_result;
-			
-			auto tempres = new tmp_return_type;
-			
-			bool has_any_parsed = std::apply(
-				helpers::any_parser_applicator<Iterator, tmp_return_type, return_type, Parsers...>, parsers)
-				(it, end, it, *tempres, final_result);
-			
-			delete tempres;
-			
-			if (has_any_parsed) {
-				*result = final_result;
+			Iterator furthest = it;
+			bool has_any_parsed = attempt(it, end, furthest, result, std::index_sequence_for<Parsers...>{});
+			if (!has_any_parsed) {
+				it = furthest; //Max failiure point
+			}
+			return has_any_parsed;
+		};
+
+	private:
+		template<typename Iterator, std::size_t ...I>
+		bool attempt(Iterator& it, Iterator end, Iterator& furthest, return_type* result, std::index_sequence<I...>) const {
+			return (attempt_one<I>(it, end, furthest, result) || ...);
+		}
+
+		//Only the alternative being tried gets a result, built right in the variant so nothing is copied or allocated
+		template<std::size_t I, typename Iterator>
+		bool attempt_one(Iterator& it, Iterator end, Iterator& furthest, return_type* result) const {
+			Iterator position = it;
+			auto& item = result->template emplace<std::tuple_element_t<I, tmp_return_type>>();
+			if (std::get<I>(parsers)(position, end, &item)) {
+				it = position;
 				return true;
 			}
-			else {
-				//it = backtrack;
-				return false;
+			if (furthest < position) furthest = position;
+			return false;
+		}
+	};
+
+	/*
+		Trie of keywords built at compile time, the root is a table on the first character.
+		match() reads the input once and takes the longest keyword, so XL and XLI need no ordering
+	*/
+	template<std::size_t ...N>
+	struct Keywords {
+		static constexpr std::size_t count = sizeof...(N);
+		static constexpr std::size_t max_nodes = ((N - 1) + ... + 1);
+
+		struct Node {
+			char ch{ 0 };
+			short child{ -1 };
+			short sibling{ -1 };
+			short accept{ -1 }; //Keyword ending here
+		};
+
+		Node nodes[max_nodes]{};
+		short first[256]{};
+		short used{ 1 };
+
+		constexpr Keywords(const char(&...words)[N]) {
+			for (short& f : first) f = -1;
+			short index = 0;
+			(insert(words, N - 1, index++), ...);
+		}
+
+		//Index of the longest keyword at it and it moved past it, -1 and it left where no keyword goes on otherwise
+		template<typename Iterator>
+		int match(Iterator& it, Iterator end) const {
+			if (it == end) return -1;
+			short node = first[(unsigned char)*it];
+			if (node < 0) return -1;
+			++it;
+
+			int found = nodes[node].accept;
+			Iterator after = it;
+			while (it != end) {
+				short next = child(node, *it);
+				if (next < 0) break;
+				node = next;
+				++it;
+				if (nodes[node].accept >= 0) {
+					found = nodes[node].accept;
+					after = it;
+				}
+			}
+			if (found >= 0) it = after;
+			return found;
+		}
+
+		//Index of the keyword spelled by the whole text, -1 if it is none
+		template<typename Text>
+		int find(Text const& text) const {
+			auto c = std::begin(text);
+			if (c == std::end(text)) return -1;
+			short node = first[(unsigned char)*c];
+			while (node >= 0 && ++c != std::end(text)) {
+				node = child(node, *c);
+			}
+			return node < 0 ? -1 : nodes[node].accept;
+		}
+
+	private:
+		constexpr short child(short node, char c) const {
+			for (short k = nodes[node].child; k >= 0; k = nodes[k].sibling) {
+				if (nodes[k].ch == c) return k;
+			}
+			return -1;
+		}
+
+		constexpr short add(char c) {
+			nodes[used].ch = c;
+			return used++;
+		}
+
+		constexpr void insert(const char* word, std::size_t size, short index) {
+			short node = first[(unsigned char)word[0]];
+			if (node < 0) node = first[(unsigned char)word[0]] = add(word[0]);
+			for (std::size_t i = 1; i < size; i++) {
+				short next = child(node, word[i]);
+				if (next < 0) {
+					next = add(word[i]);
+					nodes[next].sibling = nodes[node].child;
+					nodes[node].child = next;
+				}
+				node = next;
 			}
+			nodes[node].accept = index;
+		}
+	};
+
+	/*
+		Reads a keyword and runs the parser in the same position for what follows it,
+		one step instead of trying every keyword in turn like Any would
+	*/
+	template<typename Words, typename ...Parsers>
+	struct Switch {
+		using is_parser_type = std::true_type;
+		using return_type = typename traits::unique_variant<typename Parsers::return_type...>;
+		using tmp_return_type = typename std::tuple<typename Parsers::return_type...>;
+
+		Words const words;
+		std::tuple<Parsers...> const parsers;
+
+		constexpr Switch(Words const& w, Parsers const& ...p) :words(w), parsers(p...) {
+			static_assert(Words::count == sizeof...(Parsers), "Every keyword needs a parser");
+		};
+
+		template<typename Iterator>
+		bool operator()(Iterator& it, Iterator end, return_type* result) const {
+			int keyword = words.match(it, end);
+			if (keyword < 0) return false;
+			return dispatch(keyword, it, end, result, std::index_sequence_for<Parsers...>{});
 		};
+
+	private:
+		template<typename Iterator, std::size_t ...I>
+		bool dispatch(int keyword, Iterator& it, Iterator end, return_type* result, std::index_sequence<I...>) const {
+			return ((keyword == (int)I && dispatch_one<I>(it, end, result)) || ...);
+		}
+
+		template<std::size_t I, typename Iterator>
+		bool dispatch_one(Iterator& it, Iterator end, return_type* result) const {
+			auto& item = result->template emplace<std::tuple_element_t<I, tmp_return_type>>();
+			return std::get<I>(parsers)(it, end, &item);
+		}
 	};
 
 	template<typename Parser, typename Separator,
@@ -816,9 +921,8 @@ namespace constfuse {
 
 			auto res = p(it, end, &temp);
 			if (res) {
+				result->push_back(std::move(temp));
 				res = Many(sep << p)(it, end, result);
-				if (res) result->insert(result->begin(), std::forward<inner_parser_type>(temp));
-
 			}
 			return res;
 		}
@@ -1118,6 +1222,309 @@ namespace constfuse {
 		uint16_t col_{0};
 	};
 
+	/*
+		Text already in contiguous memory ( a mapped file ) needs none of the buffering above,
+		a copy is a pointer so backtracking is free. Line and column are counted from the start
+		of the text only when asked for, which is when an error gets reported
+	*/
+	template<typename T, std::size_t threshold, typename Context>
+	struct ContextAwareIterator<T const*, threshold, Context> {
+
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T const*;
+		using reference = T const&;
+
+		ContextAwareIterator(T const* it) :start(it), current(it) {};
+		ContextAwareIterator(T const* it, Context& context) :start(it), current(it), ctx(&context) {};
+
+		ContextAwareIterator operator ++(int) {
+			ContextAwareIterator temp(*this);
+			++current;
+			return temp;
+		}
+
+		ContextAwareIterator& operator ++() {
+			++current;
+			return *this;
+		}
+
+		bool operator ==(ContextAwareIterator const& rhs) const {
+			return current == rhs.current;
+		}
+
+		bool operator !=(ContextAwareIterator const& rhs) const {
+			return current != rhs.current;
+		}
+
+		reference operator*() const {
+			return *current;
+		}
+
+		bool operator <(ContextAwareIterator const& rhs) const {
+			return current < rhs.current;
+		}
+
+		T const* base() const { return current; }
+
+		Context& getContext() { return *ctx; }
+
+		//Same counting as the buffered iterator, every '\n' or '\r' starts a line
+		std::size_t line() const {
+			std::size_t lines = 1;
+			for (T const* c = start; c != current; ++c) {
+				if (*c == '\n' || *c == '\r') ++lines;
+			}
+			return lines;
+		}
+
+		std::size_t column() const {
+			T const* c = current;
+			while (c != start && c[-1] != '\n' && c[-1] != '\r') --c;
+			return (std::size_t)(current - c);
+		}
+
+	private:
+		T const* start;
+		T const* current;
+		Context* ctx{ nullptr };
+	};
+
+
+	//Iterators that can say where in memory they are, string parsers keep views of the source for those
+	template<typename Iterator, typename = std::void_t<>>
+	struct is_contiguous_text : std::false_type {};
+
+	template<typename Iterator>
+	struct is_contiguous_text<Iterator, std::void_t<decltype(std::declval<Iterator const&>().base())>>
+		: std::is_same<decltype(std::declval<Iterator const&>().base()), char const*> {};
+
+	template<typename Iterator>
+	static constexpr bool is_contiguous_text_v = is_contiguous_text<Iterator>::value;
+
+	/*
+		Text matched by the string parsers. Over contiguous text it is a view of the source that
+		grows by moving its end, the characters are only copied into owned when the iterator
+		can not point back into the source or pieces that are not next to each other get joined.
+		Converters hand it on as a std::string
+	*/
+	struct Lexeme {
+		char const* first{ nullptr };
+		std::size_t length{ 0 };
+		std::string owned;
+
+		std::string_view view() const {
+			return first != nullptr ? std::string_view(first, length) : std::string_view(owned);
+		}
+
+		std::string str() const { return std::string(view()); }
+		operator std::string() const { return str(); }
+
+		std::size_t size() const { return view().size(); }
+		bool empty() const { return size() == 0; }
+
+		void clear() {
+			first = nullptr;
+			length = 0;
+			owned.clear();
+		}
+
+		//Source characters [from, to)
+		void extend(char const* from, char const* to) {
+			if (first == nullptr && owned.empty()) {
+				first = from;
+				length = (std::size_t)(to - from);
+			}
+			else if (first != nullptr && first + length == from) {
+				length += (std::size_t)(to - from);
+			}
+			else {
+				append(std::string_view(from, (std::size_t)(to - from)));
+			}
+		}
+
+		void append(std::string_view text) {
+			if (first != nullptr) {
+				owned.assign(first, length);
+				first = nullptr;
+				length = 0;
+			}
+			owned.append(text);
+		}
+
+		void push_back(char c) { append(std::string_view(&c, 1)); }
+	};
+
+	//What converters pass on, lexemes become strings and everything else goes through as it is
+	template<typename T>
+	decltype(auto) owned(T&& value) {
+		using V = std::decay_t<T>;
+		if constexpr (std::is_same_v<V, Lexeme>) {
+			return value.str();
+		}
+		else if constexpr (std::is_same_v<V, std::vector<Lexeme>>) {
+			std::vector<std::string> strings;
+			strings.reserve(value.size());
+			for (Lexeme const& l : value) strings.push_back(l.str());
+			return strings;
+		}
+		else {
+			return std::forward<T>(value);
+		}
+	}
+
+	namespace memo {
+		//Memo tables are only valid inside a MemoScope, every scope gets its own generation
+		struct State {
+			std::size_t generation{ 0 };
+			std::size_t depth{ 0 };
+		};
+
+		inline State& state() {
+			thread_local State s;
+			return s;
+		}
+	}
+
+	/*
+		Packrat memoization, remembers for every position p was tried at whether it matched,
+		where it stopped and what it returned. Rules that start with the same p read that part once.
+		Copies of a Memo share their table through the Rule id, give every memoized rule its own.
+		Only works inside a MemoScope and only for contiguous iterators ( the position is the key,
+		looked up through a hash index so long lines stay linear ), otherwise p simply runs. Either way the result is replaced, not appended to,
+		and only when p matches, a failed try leaves it as it was
+	*/
+	template<std::size_t Rule, typename Parser>
+	struct Memo {
+		using is_parser_type = std::true_type;
+		using return_type = typename Parser::return_type;
+
+		Parser const p;
+		constexpr Memo(Parser const& p_) :p(p_) {};
+
+		template<typename Iterator>
+		bool operator()(Iterator& it, Iterator end, return_type* result) const {
+			if constexpr (is_contiguous_text_v<Iterator>) {
+				memo::State const& s = memo::state();
+				if (s.depth == 0) return run(it, end, result);
+
+				Arena<Iterator>& arena = arena_for<Iterator>();
+				if (arena.generation != s.generation) {
+					arena.entries.clear();
+					arena.generation = s.generation;
+				}
+
+				char const* at = it.base();
+				if (Entry<Iterator> const* e = arena.find(at)) {
+					it = e->after;
+					if (e->matched) *result = e->result;
+					return e->matched;
+				}
+
+				return_type parsed{};
+				bool matched = p(it, end, &parsed);
+				arena.insert({ at, it, matched, parsed });
+				if (matched) *result = std::move(parsed);
+				return matched;
+			}
+			else {
+				return run(it, end, result);
+			}
+		}
+
+	private:
+		//p without the table, what it returns is handed over the same way
+		template<typename Iterator>
+		bool run(Iterator& it, Iterator end, return_type* result) const {
+			return_type parsed{};
+			bool matched = p(it, end, &parsed);
+			if (matched) *result = std::move(parsed);
+			return matched;
+		}
+
+		template<typename Iterator>
+		struct Entry {
+			char const* at;
+			Iterator after;
+			bool matched;
+			return_type result;
+		};
+
+		//Cleared lazily when a new scope starts, the storage stays for the next one
+		template<typename Iterator>
+		struct Arena {
+			//Open addressed index into entries, slots of an older generation are empty
+			struct Slot {
+				char const* at{ nullptr };
+				std::size_t generation{ 0 };
+				std::size_t entry{ 0 };
+			};
+
+			std::size_t generation{ 0 };
+			std::vector<Entry<Iterator>> entries;
+			std::vector<Slot> slots;
+
+			Entry<Iterator> const* find(char const* at) const {
+				if (slots.empty()) return nullptr;
+				std::size_t mask = slots.size() - 1;
+				//Positions are consecutive, their low bits spread them well enough
+				for (std::size_t i = reinterpret_cast<std::uintptr_t>(at) & mask; slots[i].generation == generation; i = (i + 1) & mask) {
+					if (slots[i].at == at) return &entries[slots[i].entry];
+				}
+				return nullptr;
+			}
+
+			void insert(Entry<Iterator>&& e) {
+				entries.push_back(std::move(e));
+				//At most half full, the size stays a power of two
+				if (entries.size() * 2 > slots.size()) {
+					slots.assign(std::max<std::size_t>(16, slots.size() * 2), Slot{});
+					for (std::size_t k = 0; k + 1 < entries.size(); k++) place(k);
+				}
+				place(entries.size() - 1);
+			}
+
+			void place(std::size_t k) {
+				std::size_t mask = slots.size() - 1;
+				std::size_t i = reinterpret_cast<std::uintptr_t>(entries[k].at) & mask;
+				while (slots[i].generation == generation) i = (i + 1) & mask;
+				slots[i] = { entries[k].at, generation, k };
+			}
+		};
+
+		template<typename Iterator>
+		static Arena<Iterator>& arena_for() {
+			thread_local Arena<Iterator> arena;
+			return arena;
+		}
+	};
+
+	template<std::size_t Rule, typename Parser>
+	constexpr auto memoize(Parser const& p) {
+		return Memo<Rule, Parser>(p);
+	}
+
+	//Everything Memo remembers while p runs is forgotten after it, EXPLOR scopes it to a line
+	template<typename Parser>
+	struct MemoScope {
+		using is_parser_type = std::true_type;
+		using return_type = typename Parser::return_type;
+
+		Parser const p;
+		constexpr MemoScope(Parser const& p_) :p(p_) {};
+
+		template<typename Iterator>
+		bool operator()(Iterator& it, Iterator end, return_type* result) const {
+			struct Guard {
+				memo::State& s;
+				Guard(memo::State& state) :s(state) { ++s.generation; ++s.depth; }
+				~Guard() { --s.depth; ++s.generation; }
+			} guard(memo::state());
+
+			return p(it, end, result);
+		}
+	};
 
 	template<typename T>
 	struct GenericContext {
@@ -1191,7 +1598,7 @@ namespace constfuse {
 
 		template<typename T, class Tuple, std::size_t ...I>
 		static constexpr T tuple_forwarder(Tuple&& t, std::index_sequence<I...>) {
-			return T{ std::get<I>(std::forward<Tuple>(t)) ... };
+			return T{ owned(std::get<I>(std::forward<Tuple>(t))) ... };
 		}
 
 		template<typename T, typename Tuple>
@@ -1207,12 +1614,12 @@ namespace constfuse {
 
 		template<typename From>
 		To operator()(From&& obj) const {
-			return To{ std::forward<From>(obj) };
+			return To{ owned(std::forward<From>(obj)) };
 		}
 
 		template<typename ...From>
 		To operator()(std::tuple<From...>&& obj) const {
-			return tuple_to_object<To, std::add_lvalue_reference_t<std::tuple<From...>>, I...>(obj);
+			return tuple_to_object<To, std::tuple<From...>, I...>(std::move(obj));
 		}
 	};
 
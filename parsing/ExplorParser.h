@@ -10,10 +10,12 @@ using namespace constfuse::string;
 using ctxIter = ContextAwareIterator<std::string::iterator>;
 
 
-std::array<std::string, 17> fnames = { "AXL","BAXL","BPXL","BXL","CAMERA","CHP","CHV","DO","GOTO","IF","MODE","PAT","PXL","SVP","WBT","XL","XLI" };
+//Opcodes in the order of their parsers in opcodes below
+constexpr auto opcode_names = Keywords("PAT", "WBT", "MODE", "CAMERA", "XL", "AXL", "PXL", "BXL", "BAXL", "BPXL",
+	"GOTO", "IF", "DO", "SVP", "CHV", "CHP", "XLI");
 
-constexpr auto notopcode = [](bool& res, std::string& name)->std::string {
-	bool hasFound = std::find(fnames.begin(), fnames.end(), name) != fnames.end();
+constexpr auto notopcode = [](bool& res, Lexeme& name)->std::string {
+	bool hasFound = opcode_names.find(name.view()) >= 0;
 	if (hasFound) {
 		name.clear(); res = false;
 	}
@@ -21,7 +23,7 @@ constexpr auto notopcode = [](bool& res, std::string& name)->std::string {
 		res = true;
 	};
 
-	return name;
+	return name.str();
 };
 
 constexpr auto success_to_bool = [](bool& r, auto)->bool {
@@ -35,20 +37,27 @@ constexpr auto to_triplet = [](std::tuple<char, char, char> t) {
 	return std::array<char, 3>{std::get<0>(t), std::get<1>(t), std::get<2>(t) };
 };
 
-constexpr auto to_bin_octal = [](std::string n) {
+//Every octal digit is 3 bits of the row, most significant first
+constexpr auto to_bin_octal = [](Lexeme const& digits) {
+	std::string_view n = digits.view();
 	Pattern res;
-	std::for_each(n.begin(), n.end(), [&](char item) {
-		uint8_t num = item - '0';
-		res.push_back((num / 4) % 2);
-		res.push_back((num / 2) % 2);
-		res.push_back(num % 2);
-		});
+	res.size = n.size() * 3;
+	res.words.assign((res.size + 63) / 64, 0);
+	for (std::size_t i = 0; i < n.size(); i++) {
+		std::uint64_t num = (std::uint64_t)(n[i] - '0');
+		//Reverse the digit so its first bit lands on the lowest column
+		std::uint64_t bits = ((num >> 2) & 1) | (num & 2) | ((num & 1) << 2);
+		std::size_t c = i * 3;
+		res.words[c >> 6] |= bits << (c & 63);
+		if ((c & 63) > 61) res.words[(c >> 6) + 1] |= bits >> (64 - (c & 63));
+	}
 	return res;
 };
 
 constexpr auto mode1 = (ParseLit("WRP") | to_value(WrapMode::WRP)) || (ParseLit("PLN") | to_value(WrapMode::PLN));
 constexpr auto mode2 = ParseLit("TST") | to_value(RenderMode::TST) || ParseLit("RUN") | to_value(RenderMode::RUN);
 constexpr auto mode3 = ParseLit("SQR") | to_value(NeighbourhoodMode::SQR) || ParseLit("HEX") | to_value(NeighbourhoodMode::HEX);
+constexpr auto mode4 = ParseLit("INP") | to_value(UpdateMode::INP) || ParseLit("SYN") | to_value(UpdateMode::SYN);
 
 constexpr auto compare_funcs = ParseLit("EQ") | to_value(Compares::EQ) ||
 ParseLit("LT") | to_value(Compares::LT) ||
@@ -73,15 +82,13 @@ constexpr auto nums = Many("1..9"_range);
 constexpr auto to_int = Converter<int>{};
 constexpr auto to_probability = Converter<Probability>{};
 
-constexpr auto chr2s = [](auto v) { return std::string(1, v); };
-
 constexpr auto ws = Optional(monadic::Repeat(symbs<' ', '\t'>()));
 constexpr auto nl = Optional(symbs<'\n', '\r', '\0'>());
 constexpr auto brackets = compound::Wrapper('('_symb, ')'_symb);
 constexpr auto octal_number = (ws << monadic::Many(AcceptString("0..7"_range)) >> ws);
 
 constexpr auto alphanumeric = monadic::Many(AcceptString("a..z"_range || "A..Z"_range || "0..9"_range));
-constexpr auto int_num = ("1..9"_range % chr2s && Optional(monadic::Many(AcceptString("0..9"_range))));
+constexpr auto int_num = (AcceptString("1..9"_range) && Optional(monadic::Many(AcceptString("0..9"_range))));
 constexpr auto variable = alphanumeric % Converter<Parameter>{};
 constexpr auto line_label = (alphanumeric >> ws) | notopcode;
 
@@ -94,10 +101,12 @@ constexpr auto prob_definition = (brackets(Seq(x_, (int_num >> comma) % to_int,
 constexpr auto pxl_value = "A..Z"_range || "0..9"_range;
 constexpr auto pxl_rplace = AcceptString(pxl_value) && AcceptString(pxl_value);
 constexpr auto pxl_list = monadic::Many(AcceptString(pxl_value));
+//The last two forms of xlit start with the same list, without the memo a plain list is read twice
+constexpr auto xlit_list = memoize<0>(pxl_list);
 constexpr auto xlit = brackets(
 (SepBy(pxl_rplace, comma) >> Not(pxl_value)) % Converter<XLIT>{} ||
-(Seq(pxl_list, ParseLit("...") | success_to_bool)) % Converter<XLIT>{} ||
-(Seq(pxl_list, Success() | to_value(false))) % Converter<XLIT>{});
+(Seq(xlit_list, ParseLit("...") | success_to_bool)) % Converter<XLIT>{} ||
+(Seq(xlit_list, Success() | to_value(false))) % Converter<XLIT>{});
 
 constexpr auto pxlit = brackets(SepBy(Seq(pxl_value, pxl_value, pxl_value) % to_triplet, comma) % Converter<PXLIT>{});
 constexpr auto trans_filter = brackets(RepeatN(variable >> Optional(comma), 8));
@@ -106,7 +115,7 @@ constexpr auto prob_function = [](auto ...parguments) { return ws << Seq(prob_de
 
 
 constexpr auto WBT_ = brackets(Seq(pxl_list >> Optional(comma), pxl_list >> Optional(comma), pxl_list)) % Converter<WBT>{};
-constexpr auto MODE_ = brackets(Seq(mode1 >> comma, mode2 >> comma, mode3)) % Converter<MODE>{};
+constexpr auto MODE_ = brackets(Seq(mode1 >> comma, mode2 >> comma, mode3, Optional(comma << mode4))) % Converter<MODE>{};
 constexpr auto CAMERA = int_num % to_int % Converter<CAM>{};
 
 constexpr auto XL_ = Seq(int_num % to_int, xlit) % Converter<XL>{};
@@ -135,23 +144,24 @@ constexpr auto cond_goto = Optional(Optional(comma) << alphanumeric);
 
 //use a complex container for variables / detect what is a number and what a variable /
 
-constexpr auto opcodes = Any(ParseLit("PAT") << octal_number % to_bin_octal,
-	ParseLit("WBT") << prob_function(WBT_, cond_goto) % Converter<Command>{},
-	ParseLit("MODE") << prob_function(MODE_, cond_goto) % Converter<Command>{},
-	ParseLit("CAMERA") << prob_function(CAMERA, cond_goto) % Converter<Command>{},
-	ParseLit("XL") << prob_function(XL_, cond_goto) % Converter<Command>{},
-	ParseLit("AXL") << prob_function(AXL_, cond_goto) % Converter<Command>{},
-	ParseLit("PXL") << prob_function(PXL_, cond_goto) % Converter<Command>{},
-	ParseLit("BXL") << prob_function(BXL_, cond_goto) % Converter<Command>{},
-	ParseLit("BAXL") << prob_function(BAXL_, cond_goto) % Converter<Command>{},
-	ParseLit("BPXL") << prob_function(BPXL_, cond_goto) % Converter<Command>{},
-	ParseLit("GOTO") << prob_function(GOTO_) % Converter<Command>{},
-	ParseLit("IF") << prob_function(IF_, alphanumeric) % Converter<Command>{},
-	ParseLit("DO") << prob_function(DO_, cond_goto) % Converter<Command>{},
-	ParseLit("SVP") << prob_function(SVP_, cond_goto) % Converter<Command>{},
-	ParseLit("CHV") << prob_function(CHV_, cond_goto) % Converter<Command>{},
-	ParseLit("CHP") << prob_function(CHP_, cond_goto) % Converter<Command>{},
-	ParseLit("XLI") << prob_function(XLI_, cond_goto) % Converter<Command>{});
-
-constexpr auto pattern = Repeat(Seq(Optional(line_label), opcodes) >> nl);
+constexpr auto opcodes = Switch(opcode_names,
+	octal_number % to_bin_octal,
+	prob_function(WBT_, cond_goto) % Converter<Command>{},
+	prob_function(MODE_, cond_goto) % Converter<Command>{},
+	prob_function(CAMERA, cond_goto) % Converter<Command>{},
+	prob_function(XL_, cond_goto) % Converter<Command>{},
+	prob_function(AXL_, cond_goto) % Converter<Command>{},
+	prob_function(PXL_, cond_goto) % Converter<Command>{},
+	prob_function(BXL_, cond_goto) % Converter<Command>{},
+	prob_function(BAXL_, cond_goto) % Converter<Command>{},
+	prob_function(BPXL_, cond_goto) % Converter<Command>{},
+	prob_function(GOTO_) % Converter<Command>{},
+	prob_function(IF_, alphanumeric) % Converter<Command>{},
+	prob_function(DO_, cond_goto) % Converter<Command>{},
+	prob_function(SVP_, cond_goto) % Converter<Command>{},
+	prob_function(CHV_, cond_goto) % Converter<Command>{},
+	prob_function(CHP_, cond_goto) % Converter<Command>{},
+	prob_function(XLI_, cond_goto) % Converter<Command>{});
+
+constexpr auto pattern = Repeat(MemoScope(Seq(Optional(line_label), opcodes) >> nl));
 
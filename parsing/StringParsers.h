@@ -69,10 +69,11 @@ namespace constfuse::string {
 		}
 	};
 
+	//Text the parser went over, a view of the source when the iterator allows it
 	template<typename Parser>
 	struct AcceptString {
 		using is_parser_type = std::true_type;
-		using return_type = std::string;
+		using return_type = Lexeme;
 		using parser_return_type = typename Parser::return_type;
 
 		Parser const p;
@@ -83,17 +84,30 @@ namespace constfuse::string {
 		bool operator()(Iterator& it, Iterator end, return_type* result) const {
 
 			parser_return_type p_result;
-			auto res = p(it, end, &p_result);
-			if (res) {
-				if constexpr (std::is_same_v<parser_return_type, char>) {
-					result->append(std::string(1, p_result));
+			if constexpr (is_contiguous_text_v<Iterator>) {
+				char const* from = it.base();
+				if (p(it, end, &p_result)) {
+					result->extend(from, it.base());
+					return true;
 				}
-				else {
-					result->append(p_result);
+				return false;
+			}
+			else {
+				auto res = p(it, end, &p_result);
+				if (res) {
+					if constexpr (std::is_same_v<parser_return_type, char>) {
+						result->push_back(p_result);
+					}
+					else if constexpr (std::is_same_v<parser_return_type, Lexeme>) {
+						result->append(p_result.view());
+					}
+					else {
+						result->append(p_result);
+					}
+					return true;
 				}
-				return true;
+				return false;
 			}
-			return false;
 		}
 	};
 
@@ -119,7 +133,7 @@ namespace constfuse::string {
 	template<std::size_t Size>
 	struct ParseLit {
 		using is_parser_type = std::true_type;
-		using return_type = std::string;
+		using return_type = Lexeme;
 
 		const char* const p_;
 		const std::size_t sz_;
@@ -130,10 +144,19 @@ namespace constfuse::string {
 		bool operator()(Iterator& it, Iterator end, return_type* result) const {
 			if (it == end) return false;
 			std::size_t cnt = 0;
-			while (it != end && *it == *(p_ + cnt))
-			{
-				result->append(std::string(1, *it));
-				++it; cnt++;
+			if constexpr (is_contiguous_text_v<Iterator>) {
+				char const* from = it.base();
+				while (it != end && *it == *(p_ + cnt)) {
+					++it; cnt++;
+				}
+				result->extend(from, it.base());
+			}
+			else {
+				while (it != end && *it == *(p_ + cnt))
+				{
+					result->push_back(*it);
+					++it; cnt++;
+				}
 			}
 			if (cnt == sz_) {
 				return true;
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <optional>
+#include <cstdlib>
+#include <new>
+
+/*
+	Counts the heap allocations of parsing one line of every kind and fails when a kind
+	makes more than it used to. Any builds only the alternative being tried, in place,
+	so only the values the commands keep should allocate
+*/
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size) {
+	allocations++;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+#include "../bench/Bench.h"
+
+//Alternatives of different types that own vectors, the last one is the one that matches
+constexpr auto settings = Any(
+	ParseLit("PAT") << octal_number % to_bin_octal,
+	ParseLit("MODE") << prob_function(MODE_, cond_goto) % Converter<Command>{},
+	ParseLit("WBT") << prob_function(WBT_, cond_goto) % Converter<Command>{});
+
+//Allocations of parsing the whole text with parser, nullopt when it does not parse
+template<typename Parser>
+std::optional<std::size_t> countParse(Parser const& parser, std::string const& text, typename Parser::return_type& result) {
+	std::size_t before = allocations;
+	bool parsed = bench::parse(parser, text, result);
+	std::size_t count = allocations - before;
+	if (!parsed) return std::nullopt;
+	return count;
+}
+
+int failed = 0;
+
+void check(std::string const& name, std::optional<std::size_t> count, std::size_t most) {
+	if (!count) {
+		std::cout << "FAIL " << name << " does not parse\n";
+		failed++;
+	}
+	else if (count.value() > most) {
+		std::cout << "FAIL " << name << ": " << count.value() << " allocations, at most " << most << " expected\n";
+		failed++;
+	}
+	else {
+		std::cout << "ok   " << name << ": " << count.value() << " allocations\n";
+	}
+}
+
+int main() {
+	struct Case {
+		std::string line;
+		std::size_t most;
+	};
+	std::vector<Case> cases = {
+		{ "\tXL (1,1)3(01,10)\n", 4 },
+		{ "\tWBT (1,1)(ABCD,0123,WXYZ)\n", 0 },
+		{ "\tMODE (1,1)(WRP,RUN,HEX)\n", 0 },
+		{ "BG AXL (1,1)1234,ABRL,01,6(A2,B2)\n", 15 },
+		{ "\tPXL (1,1)N,1(010,101)\n", 9 },
+		{ "\tCAMERA (1,1)1\n", 0 },
+		{ "\tXLI (1,1)A,NUMS,1(0...)\n", 3 },
+		{ "BTL\tPAT 363734\n", 2 },
+		{ "\tGOTO (X,3,1) BG\n", 0 },
+	};
+
+	for (auto const& c : cases) {
+		std::string name = c.line.substr(c.line.find_first_not_of('\t'));
+		name.pop_back();
+
+		//The first parse sets up whatever is kept between lines
+		for (int pass = 0; pass < 2; pass++) {
+			decltype(pattern)::return_type result;
+			result.reserve(1);
+			auto count = countParse(pattern, c.line, result);
+			if (pass == 1) check(name, result.size() == 1 ? count : std::nullopt, c.most);
+		}
+	}
+
+	decltype(settings)::return_type setting;
+	check("Any of PAT, MODE, WBT", countParse(settings, "WBT (1,1)(ABCD,0123,WXYZ)", setting), 0);
+
+	return failed == 0 ? 0 : 1;
+}